@@ -0,0 +1,107 @@
+/**
+ * @file color_quantizer.cc
+ * @author Garrett Rhoads
+ * @brief ColorQuantizer methods
+ * @date 2025-01-20
+ */
+
+#include <vector>
+#include <climits>
+#include "color_quantizer.h"
+
+using namespace std;
+
+const int CUBE_SIZE = 32;
+
+/**
+ * @brief Construct a new ColorQuantizer, filling the cube with the closest 
+ *        colour to the centre of each of its cells
+ * 
+ * @param colors - the set to quantise to, at most 256 colours
+ * @param numbers - the terminal's number for each colour
+ */
+ColorQuantizer::ColorQuantizer(const vector<Rgb>& colors, const vector<short>& numbers) {
+    _colors = colors;
+    _numbers = numbers;
+    _cube.resize(CUBE_SIZE * CUBE_SIZE * CUBE_SIZE);
+
+    for (int r = 0; r < CUBE_SIZE; r++) {
+        for (int g = 0; g < CUBE_SIZE; g++) {
+            for (int b = 0; b < CUBE_SIZE; b++) {
+                int r_mid = (r << 3) + 4;
+                int g_mid = (g << 3) + 4;
+                int b_mid = (b << 3) + 4;
+                int best = 0;
+                int best_distance = INT_MAX;
+
+                for (size_t i = 0; i < _colors.size(); i++) {
+                    int dr = r_mid - _colors[i].r;
+                    int dg = g_mid - _colors[i].g;
+                    int db = b_mid - _colors[i].b;
+                    int distance = (dr * dr) + (dg * dg) + (db * db);
+                    if (distance < best_distance) {
+                        best_distance = distance;
+                        best = i;
+                    }
+                }
+                _cube[(r << 10) | (g << 5) | b] = best;
+            }
+        }
+    }
+}
+
+/**
+ * @brief The 6x6x6 colour cube and 24 greys of xterm's 256 colours. The 16
+ *        system colours are left out since every terminal themes them
+ * 
+ * @return const ColorQuantizer& 
+ */
+const ColorQuantizer& ColorQuantizer::xterm256() {
+    static const ColorQuantizer quantizer = [] {
+        const int levels[6] = {0, 95, 135, 175, 215, 255};
+        vector<Rgb> colors;
+        vector<short> numbers;
+        for (int i = 0; i < 216; i++) {
+            colors.push_back({static_cast<unsigned char>(levels[i / 36]), 
+                              static_cast<unsigned char>(levels[(i / 6) % 6]), 
+                              static_cast<unsigned char>(levels[i % 6])});
+            numbers.push_back(16 + i);
+        }
+        for (int i = 0; i < 24; i++) {
+            unsigned char grey = 8 + (10 * i);
+            colors.push_back({grey, grey, grey});
+            numbers.push_back(232 + i);
+        }
+        return ColorQuantizer(colors, numbers);
+    }();
+    return quantizer;
+}
+
+/**
+ * @brief The 8 basic colours every colour terminal has, numbered the way 
+ *        curses and ANSI number them (red 1, green 2, blue 4)
+ * 
+ * @return const ColorQuantizer& 
+ */
+const ColorQuantizer& ColorQuantizer::basic8() {
+    static const ColorQuantizer quantizer = [] {
+        vector<Rgb> colors;
+        vector<short> numbers;
+        for (short i = 0; i < 8; i++) {
+            colors.push_back({static_cast<unsigned char>((i & 1) ? 255 : 0), 
+                              static_cast<unsigned char>((i & 2) ? 255 : 0), 
+                              static_cast<unsigned char>((i & 4) ? 255 : 0)});
+            numbers.push_back(i);
+        }
+        return ColorQuantizer(colors, numbers);
+    }();
+    return quantizer;
+}
+
+short ColorQuantizer::color_number(const int& index) const {
+    return _numbers[index];
+}
+
+int ColorQuantizer::size() const {
+    return _colors.size();
+}
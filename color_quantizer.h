@@ -0,0 +1,46 @@
+/**
+ * @file color_quantizer.h
+ * @author Garrett Rhoads
+ * @brief ColorQuantizer class definition
+ * @date 2025-01-20
+ */
+
+#ifndef COLOR_QUANTIZER_H
+#define COLOR_QUANTIZER_H
+
+#include <vector>
+#include "palette.h"
+
+using namespace std;
+
+/**
+ * @brief Maps any colour to the closest of a fixed set of terminal colours 
+ *        through a 32x32x32 lookup cube, so a cell costs one table read 
+ *        instead of a search
+ */
+class ColorQuantizer {
+public:
+    ColorQuantizer(const vector<Rgb>& colors, const vector<short>& numbers);
+
+    static const ColorQuantizer& xterm256();
+    static const ColorQuantizer& basic8();
+
+    /**
+     * @brief Finds the closest colour in the set
+     * 
+     * @param color - colour to quantise
+     * @return int - index into the set, [0, size())
+     */
+    int index(const Rgb& color) const {
+        return _cube[((color.r >> 3) << 10) | ((color.g >> 3) << 5) | (color.b >> 3)];
+    }
+    short color_number(const int& index) const;
+    int size() const;
+private:
+    vector<unsigned char> _cube;
+    vector<Rgb> _colors;
+    // the terminal's number for each colour
+    vector<short> _numbers;
+};
+
+#endif
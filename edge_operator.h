@@ -0,0 +1,54 @@
+/**
+ * @file edge_operator.h
+ * @author Garrett Rhoads
+ * @brief EdgeOperator class definition
+ * @date 2025-01-20
+ */
+
+#ifndef EDGE_OPERATOR_H
+#define EDGE_OPERATOR_H
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief A 3x3 gradient kernel, split into a difference across the cell and 
+ *        a smoothing along it. Each one only supplies its row kernel, so the 
+ *        magnitudes, directions and threshold are shared
+ */
+class EdgeOperator {
+public:
+    virtual ~EdgeOperator() = default;
+
+    static const EdgeOperator& sobel();
+    static const EdgeOperator& scharr();
+    static const EdgeOperator& prewitt();
+    static const EdgeOperator *by_name(const string& name);
+
+    /**
+     * @brief Gx and Gy of every cell in a row given the rows either side of 
+     *        it, so it works on a sliding window of rows as well as the 
+     *        whole image. The first and last cells are left alone
+     * 
+     * @param above - row above
+     * @param row - row being checked
+     * @param below - row below
+     * @param width - cells in each row
+     * @param gx - horizontal gradient of each cell
+     * @param gy - vertical gradient of each cell
+     */
+    virtual void gradient_row(const int *above, const int *row, const int *below, 
+                              const int& width, int16_t *gx, int16_t *gy) const = 0;
+    /**
+     * @brief Sum of the smoothing weights, which is how much bigger than a 
+     *        plain difference its gradients are
+     * 
+     * @return int - 4 for sobel
+     */
+    virtual int weight() const = 0;
+    virtual const char *name() const = 0;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ * @file embed_palette.cc
+ * @author Garrett Rhoads
+ * @brief Build time tool, decodes the palette atlas png into a header so the
+ *        default palette is compiled into the binary
+ * @date 2025-01-20
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace std;
+
+const int CHANNELS = 3;
+const int BYTES_PER_LINE = 16;
+
+/**
+ * @brief embed_palette <atlas png> <output header>
+ * 
+ * @return int 
+ */
+int main(int argc, char ** argv) {
+    if (argc != 3) {
+        cerr << "usage: embed_palette <atlas png> <output header>" << endl;
+        return 1;
+    }
+
+    int width, height, n;
+    unsigned char *data = stbi_load(argv[1], &width, &height, &n, CHANNELS);
+    if (data == nullptr) {
+        cerr << "Error loading " << argv[1] << endl;
+        return 1;
+    }
+
+    ofstream header(argv[2]);
+    header << "// Generated from " << argv[1] << " by embed_palette, do not edit\n"
+           << "#ifndef PALETTE_ATLAS_H\n#define PALETTE_ATLAS_H\n\n"
+           << "constexpr int EMBEDDED_ATLAS_WIDTH = " << width << ";\n"
+           << "constexpr int EMBEDDED_ATLAS_HEIGHT = " << height << ";\n"
+           << "// RGB, row major\n"
+           << "constexpr unsigned char EMBEDDED_ATLAS[] = {";
+
+    size_t size = static_cast<size_t>(width) * height * CHANNELS;
+    for (size_t i = 0; i < size; i++) {
+        header << (((i % BYTES_PER_LINE) == 0) ? "\n    " : " ") 
+               << static_cast<int>(data[i]) << ",";
+    }
+    header << "\n};\n\n#endif\n";
+    stbi_image_free(data);
+
+    return header.good() ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file frame_loader.cc
+ * @author Garrett Rhoads
+ * @brief FrameLoader methods
+ * @date 2025-01-20
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "frame_loader.h"
+
+using namespace std;
+
+/**
+ * @brief Construct a new FrameLoader and start decoding
+ * 
+ * @param filenames - every frame, in order, kept by reference
+ * @param slots - the ring, already set up the way frames should be decoded.
+ *                Frame i always goes into slot i % size
+ * @param decode - loads a frame into an image that has its filename set, 
+ *                 false when it can't
+ * @param num_threads - decode threads
+ * @param readahead - how many files past the one being decoded to hint
+ */
+FrameLoader::FrameLoader(const vector<string>& filenames, vector<Image>& slots, 
+                         const function<bool(Image&, const int&)>& decode, 
+                         const int& num_threads, const int& readahead) : 
+                         _filenames(filenames), _slots(slots), _decode(decode), 
+                         _readahead(readahead) {
+    int num_slots = _slots.size();
+    _slot_frames.assign(num_slots, -1);
+    _slot_ready.assign(num_slots, false);
+    _slot_status.assign(num_slots, FrameStatus::skipped);
+    for (int i = 0; i < num_slots; i++) {
+        _slot_turns.push_back(i);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        _threads.emplace_back(&FrameLoader::decode_frames, this);
+    }
+}
+
+/**
+ * @brief Stops the decode threads and waits for them
+ */
+FrameLoader::~FrameLoader() {
+    stop();
+    for (auto& t : _threads) {
+        t.join();
+    }
+}
+
+/**
+ * @brief Waits for the next frame in order to be decoded and hands it out. 
+ *        Give it back with release() once done with image()
+ * 
+ * @param status - whether the frame was loaded, failed or skipped
+ * @return int - the frame, -1 once every frame is handed out or on stop()
+ */
+int FrameLoader::acquire(FrameStatus& status) {
+    unique_lock<mutex> guard(_lock);
+    if (_stopping || (_next_acquire >= static_cast<int>(_filenames.size()))) {
+        return -1;
+    }
+    int frame = _next_acquire++;
+    int slot = frame % _slots.size();
+    _changed.wait(guard, [&] {
+        return _stopping || ((_slot_frames[slot] == frame) && _slot_ready[slot]);
+    });
+    if (_stopping) {
+        return -1;
+    }
+    status = _slot_status[slot];
+    return frame;
+}
+
+/**
+ * @brief The image an acquired frame was decoded into
+ * 
+ * @param frame - from acquire()
+ * @return Image& 
+ */
+Image& FrameLoader::image(const int& frame) {
+    return _slots[frame % _slots.size()];
+}
+
+/**
+ * @brief Frees an acquired frame's slot for the frame a ring later
+ * 
+ * @param frame - from acquire()
+ */
+void FrameLoader::release(const int& frame) {
+    lock_guard<mutex> guard(_lock);
+    int slot = frame % _slots.size();
+    _slot_frames[slot] = -1;
+    _slot_ready[slot] = false;
+    _slot_turns[slot] = frame + _slots.size();
+    _changed.notify_all();
+}
+
+/**
+ * @brief Frames before frame aren't wanted any more, ones not decoded yet 
+ *        are handed out as skipped without being read
+ * 
+ * @param frame - first frame still wanted
+ */
+void FrameLoader::skip_before(const int& frame) {
+    lock_guard<mutex> guard(_lock);
+    _skip_before = max(_skip_before, frame);
+}
+
+/**
+ * @brief Wakes everything waiting, acquire() returns -1 from now on
+ */
+void FrameLoader::stop() {
+    lock_guard<mutex> guard(_lock);
+    _stopping = true;
+    _changed.notify_all();
+}
+
+/**
+ * @brief Body of each decode thread: claims the next frame, waits for its 
+ *        slot to be released, hints the files after it and decodes it
+ */
+void FrameLoader::decode_frames() {
+    int num_frames = _filenames.size();
+    while (true) {
+        unique_lock<mutex> guard(_lock);
+        if (_stopping || (_next_decode >= num_frames)) {
+            return;
+        }
+        int frame = _next_decode++;
+        int slot = frame % _slots.size();
+        _changed.wait(guard, [&] { return _stopping || (_slot_turns[slot] == frame); });
+        if (_stopping) {
+            return;
+        }
+        _slot_frames[slot] = frame;
+        bool skip = (frame < _skip_before);
+        int first_hint = max(_hinted, frame + 1);
+        int last_hint = min(num_frames, frame + 1 + _readahead);
+        _hinted = max(_hinted, last_hint);
+        guard.unlock();
+
+        hint(first_hint, last_hint);
+        FrameStatus status = FrameStatus::skipped;
+        if (!skip) {
+            Image& img = _slots[slot];
+            img.set_filename(_filenames[frame]);
+            status = _decode(img, frame) ? FrameStatus::loaded : FrameStatus::failed;
+        }
+
+        guard.lock();
+        _slot_status[slot] = status;
+        _slot_ready[slot] = true;
+        _changed.notify_all();
+    }
+}
+
+/**
+ * @brief Asks the kernel to start reading files into the page cache now, so
+ *        decoding them later doesn't wait on the disk
+ * 
+ * @param first - first frame to hint
+ * @param last - one past the last frame to hint
+ */
+void FrameLoader::hint(const int& first, const int& last) const {
+    for (int frame = first; frame < last; frame++) {
+        int fd = open(_filenames[frame].c_str(), O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * @file frame_loader.h
+ * @author Garrett Rhoads
+ * @brief FrameLoader class definition
+ * @date 2025-01-20
+ */
+
+#ifndef FRAME_LOADER_H
+#define FRAME_LOADER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "image.h"
+
+using namespace std;
+
+// What happened to a frame before it was handed out
+enum class FrameStatus {
+    skipped,
+    loaded,
+    failed
+};
+
+/**
+ * @brief Decodes a list of frames ahead of whoever is using them, on 
+ *        background threads, into a ring of images that are reused frame 
+ *        after frame so their buffers are only grown once. The files after 
+ *        the ones being decoded are hinted to the kernel so they are 
+ *        already being read by the time they're needed. Frames are handed 
+ *        out in order, to any number of threads
+ */
+class FrameLoader {
+public:
+    FrameLoader(const vector<string>& filenames, vector<Image>& slots, 
+                const function<bool(Image&, const int&)>& decode, 
+                const int& num_threads, const int& readahead);
+    ~FrameLoader();
+
+    int acquire(FrameStatus& status);
+    Image& image(const int& frame);
+    void release(const int& frame);
+    void skip_before(const int& frame);
+    void stop();
+private:
+    void decode_frames();
+    void hint(const int& first, const int& last) const;
+
+    const vector<string>& _filenames;
+    vector<Image>& _slots;
+    function<bool(Image&, const int&)> _decode;
+    int _readahead;
+    vector<thread> _threads;
+
+    mutex _lock;
+    condition_variable _changed;
+    bool _stopping = false;
+    int _next_decode = 0;
+    int _next_acquire = 0;
+    int _hinted = 0;
+    int _skip_before = 0;
+    // per slot: the frame it holds, or -1, and whether that frame is done
+    vector<int> _slot_frames;
+    vector<bool> _slot_ready;
+    vector<FrameStatus> _slot_status;
+    // per slot: the only frame allowed in next, so frames fill it in order
+    vector<int> _slot_turns;
+};
+
+#endif
@@ -11,21 +11,257 @@
 #include <thread>
 #include <cstdio>
 #include <ctime>
+#include <algorithm>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <csetjmp>
+#include <jpeglib.h>
 #include "image.h"
+#include "png_writer.h"
 #include "stb_image.h"
-#include "stb_image_write.h"
 
 using namespace std;
 using namespace cv;
 
 const int CHANNELS = 3;
 const int NUM_THREADS = 4;
+// terminal cells are about twice as tall as they are wide
+const int CURSES_CELL_ASPECT = 2;
+// xterm's black in its 6x6x6 colour cube, and the dark greys drawn instead
+// of black on the black background
+const short XTERM_CUBE_BLACK = 16;
+const short XTERM_DARK_GREY = 238;
+const short BRIGHT_BLACK = 8;
+
+// Binomial kernels for the two blurs of the difference of gaussians
+const vector<int> DOG_KERNEL_1 = {1, 4, 6, 4, 1};
+const vector<int> DOG_KERNEL_2 = {1, 8, 28, 56, 70, 56, 28, 8, 1};
+
+/**
+ * @brief Folds value into a stage key
+ * 
+ * @param key - key so far
+ * @param value - parameter or input key to add
+ * @return size_t - new key
+ */
+static size_t mix_key(const size_t& key, const size_t& value) {
+    return key ^ (value + 0x9e3779b97f4a7c15ULL + (key << 6) + (key >> 2));
+}
+
+static unsigned stage_bit(const Stage& stage) {
+    return 1u << static_cast<int>(stage);
+}
+
+// 4x4 Bayer matrix, the order cells cross their ramp step in
+const int BAYER_4X4[16] = { 0,  8,  2, 10,
+                           12,  4, 14,  6,
+                            3, 11,  1,  9,
+                           15,  7, 13,  5};
+
+/**
+ * @brief Stamp of a file's size and modification time, which changes when 
+ *        the file is rewritten
+ * 
+ * @param st - the file's stat
+ * @return size_t 
+ */
+static size_t stat_stamp(const struct stat& st) {
+    size_t stamp = mix_key(0, st.st_size);
+    stamp = mix_key(stamp, st.st_mtim.tv_sec);
+    return mix_key(stamp, st.st_mtim.tv_nsec);
+}
+
+/**
+ * @brief stat_stamp() of a file by name
+ * 
+ * @param filename - file to stamp
+ * @return size_t - 0 if it can't be stat'd
+ */
+static size_t file_stamp(const string& filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return 0;
+    }
+    return stat_stamp(st);
+}
+
+/**
+ * @brief Read only memory mapping of a whole file, unmapped on destruction
+ */
+class MappedFile {
+public:
+    MappedFile(const string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, st.st_size, MADV_SEQUENTIAL);
+                _data = static_cast<unsigned char *>(addr);
+                _size = st.st_size;
+                _stamp = stat_stamp(st);
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (_data != nullptr) {
+            munmap(_data, _size);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char *data() const { return _data; }
+    size_t size() const { return _size; }
+    size_t stamp() const { return _stamp; }
+private:
+    unsigned char *_data = nullptr;
+    size_t _size = 0;
+    size_t _stamp = 0;
+};
+
+/**
+ * @brief libjpeg error manager that jumps back to the decoder instead of 
+ *        calling exit()
+ */
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<JpegError *>(cinfo->err)->jump, 1);
+}
+
+/**
+ * @brief Drops libjpeg's messages instead of printing them to stderr, where 
+ *        warnings like "Corrupt JPEG data" would garble the curses screen. 
+ *        libjpeg still counts warnings in num_warnings
+ * 
+ * @param cinfo - unused
+ */
+static void jpeg_output_message(j_common_ptr) {
+}
+
+/**
+ * @brief Scanline JPEG decoder, lets a JPEG be read a row at a time with 
+ *        libjpeg's DCT scaling
+ */
+class JpegReader {
+public:
+    JpegReader() {
+        _created = false;
+    }
+    ~JpegReader() {
+        if (_created) {
+            jpeg_destroy_decompress(&_cinfo);
+        }
+    }
+    JpegReader(const JpegReader&) = delete;
+    JpegReader& operator=(const JpegReader&) = delete;
+
+    /**
+     * @brief Reads the header and starts decompressing at 1/denom size
+     * 
+     * @param data - encoded file contents
+     * @param size - number of bytes in data
+     * @param denom - 1, 2, 4 or 8
+     * @return true 
+     * @return false 
+     */
+    bool start(const unsigned char *data, size_t size, int denom) {
+        _cinfo.err = jpeg_std_error(&_err.mgr);
+        _err.mgr.error_exit = jpeg_error_exit;
+        _err.mgr.output_message = jpeg_output_message;
+        if (setjmp(_err.jump)) {
+            return false;
+        }
+        jpeg_create_decompress(&_cinfo);
+        _created = true;
+
+        jpeg_mem_src(&_cinfo, data, size);
+        jpeg_read_header(&_cinfo, TRUE);
+        _cinfo.out_color_space = JCS_RGB;
+        _cinfo.scale_num = 1;
+        _cinfo.scale_denom = denom;
+        jpeg_start_decompress(&_cinfo);
+        return true;
+    }
+
+    /**
+     * @brief Decodes the next row
+     * 
+     * @param row - width() * 3 bytes to fill with RGB
+     * @return true 
+     * @return false 
+     */
+    bool read_row(unsigned char *row) {
+        if (setjmp(_err.jump)) {
+            return false;
+        }
+        JSAMPROW sample_row = row;
+        jpeg_read_scanlines(&_cinfo, &sample_row, 1);
+        return true;
+    }
+
+    int width() const { return _cinfo.output_width; }
+    int height() const { return _cinfo.output_height; }
+private:
+    jpeg_decompress_struct _cinfo;
+    JpegError _err;
+    bool _created;
+};
+
+/**
+ * @brief Decodes a JPEG at 1/denom of its size using libjpeg's DCT scaling
+ * 
+ * @param data - encoded file contents
+ * @param size - number of bytes in data
+ * @param denom - 1, 2, 4 or 8
+ * @param width - decoded width
+ * @param height - decoded height
+ * @return unsigned char* - malloc'd RGB pixels, nullptr on failure
+ */
+static unsigned char *decode_jpeg(const unsigned char *data, size_t size, 
+                                  int denom, int& width, int& height) {
+    JpegReader reader;
+    if (!reader.start(data, size, denom)) {
+        return nullptr;
+    }
+
+    width = reader.width();
+    height = reader.height();
+    size_t stride = static_cast<size_t>(width) * CHANNELS;
+    unsigned char *pixels = static_cast<unsigned char *>(malloc(stride * height));
+    if (pixels == nullptr) {
+        return nullptr;
+    }
+
+    for (int i = 0; i < height; i++) {
+        if (!reader.read_row(pixels + (i * stride))) {
+            free(pixels);
+            return nullptr;
+        }
+    }
+    return pixels;
+}
 
 /**
  * @brief Construct a new Image object
  */
 Image::Image() {
     _dog_threshold = 0;
+    build_lumin_lut();
 }
 
 /**
@@ -35,10 +271,12 @@ Image::Image() {
  */
 Image::Image(string filename) {
     _filename = filename;
+    build_lumin_lut();
 }
 
 void Image::set_filename(string new_filename) {
     _filename = new_filename;
+    _probed = false;
 }
 
 void Image::set_output_filename(string new_output_filename) {
@@ -49,229 +287,1457 @@ void Image::set_dog_threshold(int new_dog_threshold) {
     _dog_threshold = new_dog_threshold;
 }
 
+void Image::set_edge_threshold(int new_edge_threshold) {
+    _edge_threshold = new_edge_threshold;
+}
+
+/**
+ * @brief Downscale through a summed area table of the decoded image, which 
+ *        costs a pass over the image once and then only four lookups per 
+ *        cell for any scalar. Worth it when the same image is redone at 
+ *        many scalars
+ * 
+ * @param new_integral_image 
+ */
+void Image::set_integral_image(bool new_integral_image) {
+    _integral_image = new_integral_image;
+}
+
+void Image::set_memory_budget(size_t new_memory_budget) {
+    _memory_budget = new_memory_budget;
+}
+
+void Image::set_color_mode(ColorMode new_color_mode) {
+    _color_mode = new_color_mode;
+}
+
+void Image::set_dither_mode(DitherMode new_dither_mode) {
+    _dither_mode = new_dither_mode;
+}
+
+void Image::set_glyph_mode(GlyphMode new_glyph_mode) {
+    _glyph_mode = new_glyph_mode;
+}
+
+void Image::set_edge_source(EdgeSource new_edge_source) {
+    _edge_source = new_edge_source;
+}
+
+/**
+ * @brief Which kernel finds edges. The threshold is scaled by the operator's
+ *        weight, so one threshold means about the same edge strength for 
+ *        each of them
+ * 
+ * @param new_edge_operator - EdgeOperator::sobel(), scharr() or prewitt()
+ */
+void Image::set_edge_operator(const EdgeOperator& new_edge_operator) {
+    _edge_operator = &new_edge_operator;
+}
+
+/**
+ * @brief Keep only the strongest cell across each edge, so edges come out one
+ *        character wide instead of in runs of two or three
+ * 
+ * @param new_edge_thinning 
+ */
+void Image::set_edge_thinning(bool new_edge_thinning) {
+    _edge_thinning = new_edge_thinning;
+}
+
+/**
+ * @brief Number of times a stage's kept result was reused
+ * 
+ * @param stage - pipeline stage
+ * @return int 
+ */
+int Image::cache_hits(const Stage& stage) const {
+    return _cache_hits[static_cast<int>(stage)];
+}
+
+/**
+ * @brief Number of times a stage had to be computed
+ * 
+ * @param stage - pipeline stage
+ * @return int 
+ */
+int Image::cache_misses(const Stage& stage) const {
+    return _cache_misses[static_cast<int>(stage)];
+}
+
+/**
+ * @brief Stages a stage reads with the current modes
+ * 
+ * @param stage - pipeline stage
+ * @return unsigned - one bit per Stage
+ */
+unsigned Image::stage_inputs(const Stage& stage) const {
+    bool luminance = (_glyph_mode == GlyphMode::luminance);
+    bool diffusion = (_dither_mode == DitherMode::floyd_steinberg) || 
+                     (_dither_mode == DitherMode::atkinson);
+    switch (stage) {
+    case Stage::decode:
+        return 0;
+    case Stage::integral:
+        return stage_bit(Stage::decode);
+    case Stage::downscale:
+        return (_integral_image && !_resample) ? stage_bit(Stage::integral) : 
+                                                 stage_bit(Stage::decode);
+    case Stage::blur:
+        return stage_bit(Stage::downscale);
+    case Stage::dog:
+        return stage_bit(Stage::blur);
+    case Stage::gradients:
+        return stage_bit(Stage::downscale) | 
+               ((_edge_source == EdgeSource::blur) ? stage_bit(Stage::blur) : 0) | 
+               ((_edge_source == EdgeSource::dog) ? stage_bit(Stage::dog) : 0);
+    case Stage::diffuse:
+        return stage_bit(Stage::downscale);
+    case Stage::classify:
+        return stage_bit(Stage::downscale) | 
+               (luminance ? stage_bit(Stage::gradients) : 0) | 
+               ((luminance && diffusion) ? stage_bit(Stage::diffuse) : 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Works out which stages target reads with the current modes, plus 
+ *        everything those stages read in turn
+ * 
+ * @param target - last stage wanted
+ * @return unsigned - one bit per Stage
+ */
+unsigned Image::needed_stages(const Stage& target) const {
+    unsigned stages = stage_bit(target);
+    // stages only read earlier ones, so one pass back to front closes it
+    for (int stage = static_cast<int>(target); stage >= 0; stage--) {
+        if (stages & (1u << stage)) {
+            stages |= stage_inputs(static_cast<Stage>(stage));
+        }
+    }
+    return stages;
+}
+
+/**
+ * @brief Key for the decoded image: which file, as of which size and 
+ *        modification time, or which live frame, at what size. Like every 
+ *        stage key only the 64 bit hash is kept, not the parameters, so a 
+ *        cached result is trusted whenever the hashes match
+ * 
+ * @param decode_scale - how much smaller the image is decoded
+ * @return size_t 
+ */
+size_t Image::decode_key(const int& decode_scale) const {
+    size_t key = mix_key(static_cast<size_t>(Stage::decode), hash<string>()(_filename));
+    key = mix_key(key, _file_stamp);
+    key = mix_key(key, decode_scale);
+    return mix_key(key, _frame_version);
+}
+
+/**
+ * @brief Key for a stage's result: the keys of the stages it reads and the 
+ *        parameters it uses itself, mixed into one 64 bit hash. Equal keys 
+ *        are taken to mean an equal result
+ * 
+ * @param stage - pipeline stage after decode
+ * @return size_t 
+ */
+size_t Image::stage_key(const Stage& stage) const {
+    size_t key = static_cast<size_t>(stage);
+    unsigned inputs = stage_inputs(stage);
+    for (int input = 0; input < NUM_STAGES; input++) {
+        if (inputs & (1u << input)) {
+            key = mix_key(key, _stage_keys[input]);
+        }
+    }
+
+    switch (stage) {
+    case Stage::decode:
+    case Stage::blur:
+        break;
+    case Stage::integral:
+        key = mix_key(key, _color_mode != ColorMode::none);
+        break;
+    case Stage::downscale:
+        key = mix_key(key, _block_size);
+        key = mix_key(key, _block_height);
+        key = mix_key(key, _resample);
+        key = mix_key(key, _scaled_width);
+        key = mix_key(key, _scaled_height);
+        key = mix_key(key, _color_mode != ColorMode::none);
+        key = mix_key(key, static_cast<size_t>(_glyph_mode));
+        break;
+    case Stage::dog:
+        key = mix_key(key, _dog_threshold);
+        break;
+    case Stage::gradients:
+        key = mix_key(key, static_cast<size_t>(_edge_source));
+        key = mix_key(key, hash<string>()(_edge_operator->name()));
+        key = mix_key(key, _edge_thinning);
+        break;
+    case Stage::diffuse:
+        key = mix_key(key, static_cast<size_t>(_dither_mode));
+        key = mix_key(key, _palette_version);
+        break;
+    case Stage::classify:
+        key = mix_key(key, static_cast<size_t>(_dither_mode));
+        key = mix_key(key, static_cast<size_t>(_glyph_mode));
+        key = mix_key(key, _palette_version);
+        key = mix_key(key, _edge_threshold);
+        break;
+    }
+    return key;
+}
+
+/**
+ * @brief Brings every stage target needs up to date, in order. A stage whose
+ *        key matches the one its kept result was made with is reused, so 
+ *        changing a parameter only reruns the stages downstream of it and 
+ *        stages the current modes don't read are never run at all. The 
+ *        image has to be loaded already
+ * 
+ * @param target - last stage wanted
+ */
+void Image::run_stages(const Stage& target) {
+    unsigned stages = needed_stages(target);
+    for (int stage = static_cast<int>(Stage::decode) + 1; stage < NUM_STAGES; stage++) {
+        if (!(stages & (1u << stage))) {
+            continue;
+        }
+        size_t key = stage_key(static_cast<Stage>(stage));
+        if ((_valid_stages & (1u << stage)) && (_stage_keys[stage] == key)) {
+            _cache_hits[stage]++;
+            continue;
+        }
+        _cache_misses[stage]++;
+
+        switch (static_cast<Stage>(stage)) {
+        case Stage::decode:
+            break;
+        case Stage::integral:
+            integral_image();
+            break;
+        case Stage::downscale:
+            scaled_greyscale_image();
+            break;
+        case Stage::blur:
+            blur();
+            break;
+        case Stage::dog:
+            dog();
+            break;
+        case Stage::gradients:
+            gradients();
+            break;
+        case Stage::diffuse:
+            diffuse_errors();
+            break;
+        case Stage::classify:
+            classify();
+            break;
+        }
+        _stage_keys[stage] = key;
+        _valid_stages |= 1u << stage;
+    }
+}
+
 /**
  * @brief Destroy the Image object
  */
 Image::~Image() {}
 
+/**
+ * @brief Sizes a plane to rows by cols, every cell set to value. Rows keep 
+ *        their storage, so a frame the same size as the last allocates nothing
+ * 
+ * @param plane - plane to size
+ * @param rows - rows it should have
+ * @param cols - cells in each row
+ * @param value - what every cell starts as
+ */
+template <typename T>
+static void size_plane(vector<vector<T>>& plane, const int& rows, const int& cols, 
+                       const T& value) {
+    plane.resize(rows);
+    for (vector<T>& row : plane) {
+        row.assign(cols, value);
+    }
+}
+
 /**
  * @brief Converts _image to ascii and exports it to output.txt
  * 
  * @param scalar - how much to down scale the image
+ * @param cell_aspect - how many times taller than wide each cell is, 2 to 
+ *                      classify the way the terminal modes do and the 
+ *                      palette's cell_aspect() for to_ascii_png()
  */
-void Image::to_ascii_index(const int& scalar) {
-    _scalar = scalar;
+void Image::to_ascii_index(const int& scalar, const int& cell_aspect) {
+    set_scalar(scalar, cell_aspect);
+    run_stages(Stage::classify);
+}
 
-    _scaled_width = _width / _scalar;
-    _scaled_height = _height / _scalar;
+/**
+ * @brief Classifies _image into exactly cols by rows cells, area weighted 
+ *        the way -tv and -l fill the terminal. Only the glyph grid is 
+ *        made, there is no png of it
+ * 
+ * @param cols - cells across
+ * @param rows - cells down
+ */
+void Image::to_ascii_grid(const int& cols, const int& rows) {
+    set_grid(cols, rows);
+    run_stages(Stage::classify);
+}
 
-    vector<int> _ascii_indeces_row;
+/**
+ * @brief Classifies every row of the image into _ascii_indeces, rows split
+ *        between threads
+ */
+void Image::classify() {
+    size_plane(_ascii_indeces, _scaled_height, _scaled_width, 0);
+
+    vector<thread> thread_grp;
+    thread_grp.reserve(NUM_THREADS);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        thread_grp.emplace_back([this, i]() {
+            for (int row = i; row < _scaled_height; row += NUM_THREADS) {
+                classify_row(row, _ascii_indeces[row]);
+            }
+        });
+    }
+    for (auto& t : thread_grp) {
+        t.join();
+    }
+}
 
-    int avg_lumin;
-    int ascii_idx;
-    double theta;
+/**
+ * @brief Rebuilds _lumin_lut, which maps every greyscale value straight to
+ *        its luminance character so no cell has to divide, with 255 always
+ *        landing on the last one however long the ramp, and _edge_lut 
+ *        which maps sobel directions to edge characters. Also works out the 
+ *        grey each ramp step stands for, which the dithering needs
+ */
+void Image::build_lumin_lut() {
+    int steps = _palette.num_lumin() - 1;
+    for (int grey = 0; grey < 256; grey++) {
+        _lumin_lut[grey] = (grey * steps) / 255;
+    }
+    for (int direction = 0; direction < NUM_EDGE_GLYPHS; direction++) {
+        _edge_lut[direction] = _palette.edge_glyph(direction);
+    }
 
-    scaled_greyscale_image();
+    // a step is 255 / steps greys wide, bayer spreads the thresholds over it.
+    // Each level stands for the lowest grey _lumin_lut maps to it, and 
+    // lookups are clamped to 255 first so no level passes the last one
+    _level_grey.resize(_palette.num_lumin());
+    for (int level = 0; level <= steps; level++) {
+        _level_grey[level] = ((level * 255) + (steps - 1)) / steps;
+    }
+    for (int i = 0; i < 16; i++) {
+        _bayer_offsets[i] = (((2 * BAYER_4X4[i]) + 1) * 255) / (32 * steps);
+    }
+    _rounding_offset = 255 / (2 * steps);
+}
 
-    dog(); 
-   
-    for (int i = 0; i < _scaled_height; i++) {
+/**
+ * @brief Picks the luminance character for every cell in a row. With bayer 
+ *        dithering each cell's grey is nudged by its place in the matrix 
+ *        first, which only depends on the cell's position so rows can be 
+ *        done in any order
+ * 
+ * @param row - greyscale row
+ * @param y_pos - which row it is
+ * @param indeces - glyph index for each cell
+ */
+void Image::lumin_row(const vector<int>& row, const int& y_pos, 
+                      vector<int>& indeces) const {
+    if (_dither_mode != DitherMode::bayer) {
         for (int j = 0; j < _scaled_width; j++) {
-            if ((!((i == 0) || (j == 0) || (i == (_scaled_height - 1)) || 
-                   (j == (_scaled_width - 1)))) && (sobel(j, i, theta)) &&
-                   (_greyscale_image[i][j] < 192)) {
-                
-                if ((theta < 0.1) || (theta > 0.9)) {
-                    _ascii_indeces_row.push_back(10);
-                    
-                } else if (theta < 0.4) {
-                    _ascii_indeces_row.push_back(11);
-                    
-                } else if (theta < 0.6) {
-                    _ascii_indeces_row.push_back(12);
-                    
-                } else {
-                    _ascii_indeces_row.push_back(13);
+            indeces[j] = _lumin_lut[row[j]];
+        }
+        return;
+    }
+
+    const int *offsets = &_bayer_offsets[(y_pos & 3) * 4];
+    for (int j = 0; j < _scaled_width; j++) {
+        indeces[j] = _lumin_lut[min(row[j] + offsets[j & 3], 255)];
+    }
+}
+
+/**
+ * @brief Error diffuses one row against the luminance ramp, Floyd-Steinberg 
+ *        or Atkinson. Each cell takes the nearest step and pushes what it 
+ *        missed by onto cells to its right and in the rows below
+ * 
+ * @param row - greyscale row plus the error already pushed onto it
+ * @param below - row below to push error onto, or nullptr
+ * @param below2 - row two below (atkinson only), or nullptr
+ * @param levels - luminance index for each cell
+ * @param wait_for - called with each column before it is done
+ */
+template <typename Wait>
+void Image::diffuse_row(vector<int>& row, vector<int> *below, vector<int> *below2, 
+                        vector<int>& levels, Wait wait_for) const {
+    bool atkinson = (_dither_mode == DitherMode::atkinson);
+    int last = _scaled_width - 1;
+
+    for (int j = 0; j < _scaled_width; j++) {
+        wait_for(j);
+        int grey = min(max(row[j], 0), 255);
+        int level = _lumin_lut[min(grey + _rounding_offset, 255)];
+        levels[j] = level;
+        int error = grey - _level_grey[level];
+
+        if (atkinson) {
+            int eighth = error / 8;
+            if (j < last) {
+                row[j + 1] += eighth;
+            }
+            if (j < (last - 1)) {
+                row[j + 2] += eighth;
+            }
+            if (below != nullptr) {
+                if (j > 0) {
+                    (*below)[j - 1] += eighth;
+                }
+                (*below)[j] += eighth;
+                if (j < last) {
+                    (*below)[j + 1] += eighth;
+                }
+            }
+            if (below2 != nullptr) {
+                (*below2)[j] += eighth;
+            }
+        } else {
+            if (j < last) {
+                row[j + 1] += (error * 7) / 16;
+            }
+            if (below != nullptr) {
+                if (j > 0) {
+                    (*below)[j - 1] += (error * 3) / 16;
+                }
+                (*below)[j] += (error * 5) / 16;
+                if (j < last) {
+                    (*below)[j + 1] += error / 16;
                 }
-            } else {
-                avg_lumin = _greyscale_image[i][j] * 100;
-                ascii_idx = (avg_lumin / (25500 / (_num_quantized_lumin - 1)));
-                _ascii_indeces_row.push_back(ascii_idx);
-                
             }
         }
-        _ascii_indeces.push_back(_ascii_indeces_row);
-        _ascii_indeces_row.clear();
-        
     }
-    
 }
 
 /**
- * @brief Gets _width attribute
+ * @brief Fills _lumin_levels by error diffusing _greyscale_image, or clears
+ *        it when error diffusion is off. Rows run on their own threads as a 
+ *        wavefront: a row only does a cell once the row above is far enough
+ *        past it that nothing else will be pushed onto it, or onto the cells
+ *        this row is about to push onto itself
+ */
+void Image::diffuse_errors() {
+    if ((_dither_mode != DitherMode::floyd_steinberg) && 
+        (_dither_mode != DitherMode::atkinson)) {
+        _lumin_levels.clear();
+        return;
+    }
+
+    // copying into the kept rows reuses their storage
+    vector<vector<int>>& work = _diffuse_work;
+    work = _greyscale_image;
+    size_plane(_lumin_levels, _scaled_height, _scaled_width, 0);
+    int lead = (_dither_mode == DitherMode::atkinson) ? 4 : 3;
+    if (_diffuse_rows < _scaled_height) {
+        _diffuse_progress.reset(new atomic<int>[_scaled_height]);
+        _diffuse_rows = _scaled_height;
+    }
+    atomic<int> *progress = _diffuse_progress.get();
+    for (int i = 0; i < _scaled_height; i++) {
+        progress[i].store(0);
+    }
+
+    auto diffuse_rows = [&](int first_row) {
+        for (int i = first_row; i < _scaled_height; i += NUM_THREADS) {
+            vector<int> *below = (i + 1 < _scaled_height) ? &work[i + 1] : nullptr;
+            vector<int> *below2 = (i + 2 < _scaled_height) ? &work[i + 2] : nullptr;
+            diffuse_row(work[i], below, below2, _lumin_levels[i], [&](int x_pos) {
+                progress[i].store(x_pos, memory_order_release);
+                if (i == 0) {
+                    return;
+                }
+                int needed = min(x_pos + lead, _scaled_width);
+                while (progress[i - 1].load(memory_order_acquire) < needed) {
+                    this_thread::yield();
+                }
+            });
+            progress[i].store(_scaled_width, memory_order_release);
+        }
+    };
+
+    vector<thread> thread_grp;
+    thread_grp.reserve(NUM_THREADS);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        thread_grp.emplace_back(diffuse_rows, i);
+    }
+    for (auto& t : thread_grp) {
+        t.join();
+    }
+}
+
+/**
+ * @brief Picks the palette index for every cell in a row: the luminance 
+ *        character from lumin_row() (or levels when error diffused), then 
+ *        overridden by an edge character wherever the row's gradient is 
+ *        strong enough
+ * 
+ * @param row - greyscale row being classified
+ * @param y_pos - which row it is
+ * @param magnitudes - from edge_row(), all 0 for rows without edges
+ * @param directions - from edge_row()
+ * @param indeces - glyph index for each cell
+ * @param levels - error diffused luminance indeces for the row, or nullptr
+ */
+void Image::classify_row(const vector<int>& row, const int& y_pos, 
+                         const vector<int>& magnitudes, const vector<int>& directions, 
+                         vector<int>& indeces, const vector<int> *levels) const {
+    indeces.resize(_scaled_width);
+    if (levels != nullptr) {
+        copy(levels->begin(), levels->end(), indeces.begin());
+    } else {
+        lumin_row(row, y_pos, indeces);
+    }
+    apply_edges(magnitudes, directions, indeces);
+}
+
+/**
+ * @brief Finds the gradient magnitude and direction of every dark enough cell
+ *        in a row. Nothing here depends on the edge threshold, so the threshold
+ *        can change without redoing it. All integer: the squared magnitude 
+ *        is kept doubled with the sign of Gx in the low bit, which settles 
+ *        ties at the threshold the same way the old Gx + 0.0001 did
+ * 
+ * @param above - row above in the plane edges are found in
+ * @param row - row in the plane edges are found in
+ * @param below - row below in the plane edges are found in
+ * @param grey - greyscale row, cells lighter than 192 never get edges
+ * @param magnitudes - 2 * (Gx^2 + Gy^2) + (Gx >= 0) for each cell, 0 where 
+ *                     it can't be an edge
+ * @param directions - _edge_lut index for each cell
+ */
+void Image::edge_row(const vector<int>& above, const vector<int>& row, 
+                     const vector<int>& below, const vector<int>& grey, 
+                     vector<int>& magnitudes, vector<int>& directions) {
+    magnitudes.assign(_scaled_width, 0);
+    directions.assign(_scaled_width, 0);
+    _edge_operator->gradient_row(above.data(), row.data(), below.data(), 
+                                 _scaled_width, _gx.data(), _gy.data());
+
+    for (int j = 1; j < (_scaled_width - 1); j++) {
+        if (grey[j] >= 192) {
+            continue;
+        }
+        int x = _gx[j];
+        int y = _gy[j];
+        magnitudes[j] = (2 * ((x * x) + (y * y))) + ((x >= 0) ? 1 : 0);
+        directions[j] = edge_direction(x, y);
+    }
+}
+
+/**
+ * @brief Swaps in the edge character wherever a row's gradient is over 
+ *        _edge_threshold, which is in sobel units: the magnitudes are scaled
+ *        by 4 and the threshold by the operator's weight before comparing
+ * 
+ * @param magnitudes - from edge_row()
+ * @param directions - from edge_row()
+ * @param indeces - glyph index for each cell
+ */
+void Image::apply_edges(const vector<int>& magnitudes, const vector<int>& directions, 
+                        vector<int>& indeces) const {
+    int64_t weighted = static_cast<int64_t>(_edge_threshold) * _edge_operator->weight();
+    int64_t threshold = 2 * weighted * weighted;
+    for (int j = 0; j < _scaled_width; j++) {
+        if ((16 * static_cast<int64_t>(magnitudes[j])) > threshold) {
+            indeces[j] = _edge_lut[directions[j]];
+        }
+    }
+}
+
+/**
+ * @brief Non-maximum suppression of a row: a cell keeps its magnitude only 
+ *        if it is at least as strong as both neighbours across the edge, 
+ *        the cells either side of it along its gradient. On a flat ridge 
+ *        the cell before wins, so a ridge two cells wide still keeps one
+ * 
+ * @param above - magnitudes of the row above, not yet suppressed
+ * @param row - magnitudes of the row, not yet suppressed
+ * @param below - magnitudes of the row below, not yet suppressed
+ * @param directions - _edge_lut index for each cell of the row
+ * @param magnitudes - where the suppressed row goes, can't be row
+ */
+void Image::suppress_row(const vector<int>& above, const vector<int>& row, 
+                         const vector<int>& below, const vector<int>& directions, 
+                         vector<int>& magnitudes) const {
+    for (int j = 1; j < (_scaled_width - 1); j++) {
+        // the low bit only breaks ties at the threshold
+        int m = row[j] >> 1;
+        if (m == 0) {
+            continue;
+        }
+        int before;
+        int after;
+        switch (directions[j]) {
+        case 0:
+            // horizontal edge, the gradient runs up and down
+            before = above[j];
+            after = below[j];
+            break;
+        case 1:
+            before = above[j + 1];
+            after = below[j - 1];
+            break;
+        case 2:
+            before = row[j - 1];
+            after = row[j + 1];
+            break;
+        default:
+            before = above[j - 1];
+            after = below[j + 1];
+            break;
+        }
+        if ((m <= (before >> 1)) || (m < (after >> 1))) {
+            magnitudes[j] = 0;
+        }
+    }
+}
+
+/**
+ * @brief Fills _magnitudes and _edges with the gradient of every cell, found 
+ *        in the greyscale, _blur_1 or _dog. The first and last rows have no 
+ *        edges, and neither does the frame of _blur_1 that is left at 0. 
+ *        With thinning on the rows are then suppressed top to bottom, 
+ *        keeping only the unsuppressed copy of the row above
+ */
+void Image::gradients() {
+    const vector<vector<int>> *plane = &_greyscale_image;
+    if (_edge_source == EdgeSource::blur) {
+        plane = &_blur_1;
+    } else if (_edge_source == EdgeSource::dog) {
+        plane = &_dog;
+    }
+    int margin = edge_margin();
+    size_plane(_magnitudes, _scaled_height, _scaled_width, 0);
+    size_plane(_edges, _scaled_height, _scaled_width, 0);
+    for (int i = margin; i < (_scaled_height - margin); i++) {
+        edge_row((*plane)[i - 1], (*plane)[i], (*plane)[i + 1], _greyscale_image[i], 
+                 _magnitudes[i], _edges[i]);
+        for (int j = 1; (j < margin) && (j < _scaled_width); j++) {
+            _magnitudes[i][j] = 0;
+            _magnitudes[i][_scaled_width - 1 - j] = 0;
+        }
+    }
+    if (!_edge_thinning) {
+        return;
+    }
+
+    vector<int>& above = _suppress_above;
+    vector<int>& row = _suppress_row;
+    above.assign(_scaled_width, 0);
+    for (int i = 1; i < (_scaled_height - 1); i++) {
+        row = _magnitudes[i];
+        suppress_row(above, row, _magnitudes[i + 1], _edges[i], _magnitudes[i]);
+        above.swap(row);
+    }
+}
+
+/**
+ * @brief Rows and columns at the border that never get edges: the first and 
+ *        last, and for the blur also the frame it leaves at 0
+ * 
+ * @return int 
+ */
+int Image::edge_margin() const {
+    return (_edge_source == EdgeSource::blur) ? (DOG_KERNEL_1.size() / 2) + 1 : 1;
+}
+
+/**
+ * @brief How many rows behind the greyscale to_ascii_png_streamed() finds 
+ *        edges, so the blur or DoG they come from has the greyscale rows 
+ *        around it
+ * 
+ * @return int - 0 when edges come from the greyscale or aren't found
+ */
+int Image::streamed_halo() const {
+    if (_glyph_mode == GlyphMode::shape) {
+        return 0;
+    }
+    if (_edge_source == EdgeSource::blur) {
+        return DOG_KERNEL_1.size() / 2;
+    }
+    if (_edge_source == EdgeSource::dog) {
+        return DOG_KERNEL_2.size() / 2;
+    }
+    return 0;
+}
+
+/**
+ * @brief Picks the glyph shaped most like each cell in a row, in place of 
+ *        both the luminance and the edge characters
+ * 
+ * @param keys - shape key of each cell
+ * @param indeces - glyph index for each cell
+ */
+void Image::shape_row(const vector<int>& keys, vector<int>& indeces) const {
+    indeces.resize(_scaled_width);
+    for (int j = 0; j < _scaled_width; j++) {
+        indeces[j] = _palette.shape_glyph(keys[j]);
+    }
+}
+
+/**
+ * @brief Turns the grey sums of a cell's quarters into its shape key. The 
+ *        bottom and right quarters get the extra row and column of an odd 
+ *        block, and when a block is one pixel wide or high the missing 
+ *        quarters copy the ones beside them
+ * 
+ * @param quarter_sums - top left, top right, bottom left, bottom right sums
+ * @return int - shape key
+ */
+int Image::shape_key(const int *quarter_sums) const {
+    int left = max(1, _block_size / 2);
+    int right = _block_size - left;
+    int top = max(1, _block_height / 2);
+    int bottom = _block_height - top;
+    int quarters[4];
+    quarters[0] = quarter_sums[0] / (left * top);
+    quarters[1] = (right > 0) ? (quarter_sums[1] / (right * top)) : quarters[0];
+    quarters[2] = (bottom > 0) ? (quarter_sums[2] / (left * bottom)) : quarters[0];
+    if (bottom == 0) {
+        quarters[3] = quarters[1];
+    } else {
+        quarters[3] = (right > 0) ? (quarter_sums[3] / (right * bottom)) : quarters[2];
+    }
+    return Palette::shape_key(quarters);
+}
+
+/**
+ * @brief Classifies row y_pos of _greyscale_image from the planes the 
+ *        earlier stages kept
+ * 
+ * @param y_pos - row to classify
+ * @param indeces - glyph index for each cell
+ */
+void Image::classify_row(const int& y_pos, vector<int>& indeces) const {
+    if (_glyph_mode == GlyphMode::shape) {
+        shape_row(_shape_keys[y_pos], indeces);
+        return;
+    }
+    indeces.resize(_scaled_width);
+    bool diffusion = (_dither_mode == DitherMode::floyd_steinberg) || 
+                     (_dither_mode == DitherMode::atkinson);
+    if (diffusion) {
+        copy(_lumin_levels[y_pos].begin(), _lumin_levels[y_pos].end(), indeces.begin());
+    } else {
+        lumin_row(_greyscale_image[y_pos], y_pos, indeces);
+    }
+    apply_edges(_magnitudes[y_pos], _edges[y_pos], indeces);
+}
+
+/**
+ * @brief Sets _scalar and the grid size. When the image was decoded at a 
+ *        reduced size only the remaining factor is left for convolve()
+ * 
+ * @param scalar - how much to down scale the original image across
+ * @param cell_aspect - how many times taller than wide each cell is, the 
+ *                      glyphs' for the png and 2 for terminal cells, so a 
+ *                      tall cell is sampled once instead of drawn twice
+ */
+void Image::set_scalar(const int& scalar, const int& cell_aspect) {
+    _resample = false;
+    _curses_planned = false;
+    _scalar = scalar;
+    _cell_aspect = cell_aspect;
+    _block_size = max(1, _scalar / _decode_scale);
+    _block_height = _block_size * _cell_aspect;
+
+    _scaled_width = min(_source_width / _scalar, _width / _block_size);
+    _scaled_height = min(_source_height / (_scalar * _cell_aspect), _height / _block_height);
+    _gx.resize(_scaled_width);
+    _gy.resize(_scaled_width);
+}
+
+/**
+ * @brief Sets an exact grid size, for scale factors that aren't whole. 
+ *        Cells are worked out by resample() from the weight tables built 
+ *        here, at twice the grid size so shape matching still gets quarters
+ * 
+ * @param cols - cells across
+ * @param rows - cells down
+ */
+void Image::set_grid(const int& cols, const int& rows) {
+    _resample = true;
+    _scaled_width = cols;
+    _scaled_height = rows;
+    // the nearest whole scalar, for whatever still wants one
+    _scalar = max(1, _source_width / cols);
+    _block_size = max(1, _width / cols);
+    _block_height = max(1, _height / rows);
+    build_spans(_width, cols * 2, _column_spans);
+    build_spans(_height, rows * 2, _row_spans);
+    // enough for grey and colour, so frames never have to grow them
+    _across.resize(cols * 2 * 4);
+    _halves.resize(2 * cols * 2 * 4);
+    _gx.resize(_scaled_width);
+    _gy.resize(_scaled_width);
+}
+
+/**
+ * @brief Picks the biggest grid that fits the window and keeps the image's 
+ *        shape, so the image fills the window one way or the other
+ * 
+ * @param win_width - columns of the window
+ * @param win_height - rows of the window
+ * @param cell_aspect - how many times taller than wide a window cell is
+ */
+void Image::fit_grid(const int& win_width, const int& win_height, const int& cell_aspect) {
+    int64_t cols = win_width;
+    int64_t rows = ((cols * _source_height) + ((_source_width * cell_aspect) / 2)) / 
+                   (static_cast<int64_t>(_source_width) * cell_aspect);
+    if (rows > win_height) {
+        rows = win_height;
+        cols = ((rows * cell_aspect * _source_width) + (_source_height / 2)) / _source_height;
+    }
+    set_grid(max<int64_t>(1, min<int64_t>(cols, win_width)), 
+             max<int64_t>(1, min<int64_t>(rows, win_height)));
+}
+
+/**
+ * @brief Weight table for one axis. Measured in 1/cells of a pixel, cell c 
+ *        covers [c * source, (c + 1) * source) and pixel x covers 
+ *        [x * cells, (x + 1) * cells), so every overlap is a whole number 
+ *        and each cell's weights add up to exactly source
+ * 
+ * @param source - pixels along the axis
+ * @param cells - cells along the axis
+ * @param spans - filled with one span per cell
+ */
+void Image::build_spans(const int& source, const int& cells, vector<Span>& spans) {
+    spans.resize(cells);
+    for (int c = 0; c < cells; c++) {
+        int64_t start = static_cast<int64_t>(c) * source;
+        int64_t end = start + source;
+        Span& span = spans[c];
+        span.first = start / cells;
+        int last = (end - 1) / cells;
+        span.weights.clear();
+        for (int x = span.first; x <= last; x++) {
+            int64_t pixel_start = static_cast<int64_t>(x) * cells;
+            int64_t pixel_end = pixel_start + cells;
+            span.weights.push_back(min(end, pixel_end) - max(start, pixel_start));
+        }
+    }
+}
+
+/**
+ * @brief Gets the width of the original image
  * 
  * @return int 
  */
 int Image::get_width() const {
-    return _width;
+    return _source_width;
 }
 
 /**
- * @brief Gets height attribute
+ * @brief Gets the height of the original image
  * 
  * @return int 
  */
 int Image::get_height() const {
-    return _height;
+    return _source_height;
+}
+
+/**
+ * @brief Gets the palette index of every cell from the last to_ascii_index()
+ * 
+ * @return const vector<vector<int>>& - one row per cell row
+ */
+const vector<vector<int>>& Image::get_ascii_indeces() const {
+    return _ascii_indeces;
+}
+
+/**
+ * @brief Reads the dimensions and channel count from the file header without
+ *        decoding any pixels
+ * 
+ * @return true 
+ * @return false 
+ */
+bool Image::probe() {
+    MappedFile file(_filename);
+    if (file.data() == nullptr) {
+        return false;
+    }
+
+    const unsigned char *bytes = file.data();
+    _file_stamp = file.stamp();
+    _is_jpeg = (file.size() > 2) && (bytes[0] == 0xFF) && (bytes[1] == 0xD8);
+    _probed = stbi_info_from_memory(bytes, file.size(), &_source_width, 
+                                    &_source_height, &_source_channels);
+    return _probed;
+}
+
+/**
+ * @brief Picks how much smaller a JPEG can be decoded for a given scalar
+ * 
+ * @param scalar - downscale the image will be converted at
+ * @return int - 8, 4, 2 or 1
+ */
+int Image::decode_scale_for(const int& scalar) const {
+    if (_is_jpeg) {
+        // shape matching needs at least 2x2 pixels left in every cell
+        int min_block = (_glyph_mode == GlyphMode::shape) ? 2 : 1;
+        for (int denom = 8; denom > 1; denom /= 2) {
+            if (((scalar % denom) == 0) && ((scalar / denom) >= min_block)) {
+                return denom;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Estimates the peak memory converting the probed image at scalar 
+ *        needs. The whole image path holds the decoded image, every int 
+ *        plane and the summed area table when it is used, the streamed path 
+ *        only a few rows of each (plus the decoded image when it is not a 
+ *        JPEG). Both write the png a row at a time
+ * 
+ * @param scalar - downscale the image will be converted at
+ * @param streamed - plan for to_ascii_png_streamed() instead
+ * @return size_t - bytes
+ */
+size_t Image::planned_bytes(const int& scalar, const bool& streamed) const {
+    const size_t NUM_PLANES = 6;
+    const size_t NUM_STREAMED_ROWS = 4;
+    int decode_scale = decode_scale_for(scalar);
+    size_t decoded_width = (_source_width + decode_scale - 1) / decode_scale;
+    size_t decoded_height = (_source_height + decode_scale - 1) / decode_scale;
+    size_t cells_wide = _source_width / scalar;
+    size_t cells_high = _source_height / scalar;
+    size_t raster_row = cells_wide * scalar * CHANNELS;
+    bool keep_color = (_color_mode != ColorMode::none);
+    bool keep_shape = (_glyph_mode == GlyphMode::shape);
+
+    if (streamed) {
+        size_t decoded = _is_jpeg ? (decoded_width * CHANNELS) : 
+                                    (decoded_width * decoded_height * CHANNELS);
+        int halo = streamed_halo();
+        size_t window_rows = NUM_STREAMED_ROWS + (2 * halo);
+        size_t rows = window_rows * cells_wide * sizeof(int);
+        if (keep_color) {
+            rows += window_rows * cells_wide * CHANNELS * sizeof(int);
+        }
+        if (keep_shape) {
+            rows += NUM_STREAMED_ROWS * cells_wide * 4 * sizeof(int);
+        } else {
+            // magnitudes and directions of three rows plus a thinned copy, 
+            // and three rows of the blur or DoG with the two blurs of a row
+            size_t edge_rows = (halo > 0) ? 12 : 7;
+            rows += edge_rows * cells_wide * sizeof(int);
+        }
+        return decoded + rows + raster_row;
+    }
+
+    size_t decoded = decoded_width * decoded_height * CHANNELS;
+    size_t planes = NUM_PLANES * cells_wide * cells_high * sizeof(int);
+    if (keep_color) {
+        planes += cells_wide * cells_high * sizeof(Rgb);
+    }
+    if (keep_shape) {
+        planes += cells_wide * cells_high * sizeof(int);
+    }
+    if (_integral_image) {
+        // grey, plus r, g and b with colour on, per decoded pixel
+        size_t integral_planes = keep_color ? 4 : 1;
+        planes += (decoded_width + 1) * (decoded_height + 1) * integral_planes * sizeof(uint32_t);
+    }
+    return decoded + planes + raster_row;
 }
 
 /**
- * @brief Loads the needed info into the _image attribute
+ * @brief Whether the probed image only fits in the memory budget if it is 
+ *        streamed rather than converted whole
  * 
+ * @param scalar - requested downscale
  * @return true 
  * @return false 
  */
-bool Image::load() {
+bool Image::should_stream(const int& scalar) const {
+    return (_memory_budget != 0) && (planned_bytes(scalar) > _memory_budget);
+}
+
+/**
+ * @brief Finds the smallest scalar, starting from the one asked for, that 
+ *        keeps the probed image within the memory budget
+ * 
+ * @param scalar - requested downscale
+ * @param streamed - plan for to_ascii_png_streamed() instead
+ * @return int - scalar to use, 0 if nothing fits
+ */
+int Image::fit_scalar(const int& scalar, const bool& streamed) const {
+    if (_memory_budget == 0) {
+        return scalar;
+    }
+    int largest = max(_source_width, _source_height);
+    for (int candidate = max(1, scalar); candidate <= largest; candidate++) {
+        if (planned_bytes(candidate, streamed) <= _memory_budget) {
+            return candidate;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Loads the needed info into the _image attribute. The file is mapped
+ *        rather than read through stdio and stbi's buffer is adopted as is.
+ *        JPEGs are decoded straight at 1/2, 1/4 or 1/8 size when that evenly
+ *        divides scalar, so only the rest of the downscale is done by us.
+ *        Images that would not fit in the memory budget are rejected before 
+ *        anything is decoded, and loading the same file at the same size 
+ *        again reuses what was decoded last time, unless the file has been 
+ *        changed since
+ * 
+ * @param scalar - downscale the image will be converted at, 1 if unknown
+ * @return true 
+ * @return false 
+ */
+bool Image::load(const int& scalar) {
+    // a file rewritten since it was probed may not even be the same size
+    if (_probed && (file_stamp(_filename) != _file_stamp)) {
+        _probed = false;
+    }
+    if (!_probed && !probe()) {
+        return false;
+    }
+    if ((_memory_budget != 0) && (planned_bytes(scalar) > _memory_budget)) {
+        return false;
+    }
+
+    const int decode = static_cast<int>(Stage::decode);
+    size_t key = decode_key(decode_scale_for(scalar));
+    if ((_valid_stages & (1u << decode)) && (_stage_keys[decode] == key)) {
+        _cache_hits[decode]++;
+        return true;
+    }
+    _cache_misses[decode]++;
+    _valid_stages = 0;
+
+    MappedFile file(_filename);
+    if (file.data() == nullptr) {
+        return false;
+    }
+
     int n;
-    unsigned char* data = stbi_load(_filename.c_str(),&_width,&_height,&n, 3);
-    if (data != nullptr) {
-        _image = vector<unsigned char>(data, data + _width * _height * 3);
+    const unsigned char *bytes = file.data();
+    _decode_scale = decode_scale_for(scalar);
+    if (_decode_scale > 1) {
+        unsigned char *data = decode_jpeg(bytes, file.size(), _decode_scale, 
+                                          _width, _height);
+        if (data != nullptr) {
+            _image = pixel_buffer(data, free);
+            _stage_keys[decode] = key;
+            _valid_stages |= 1u << decode;
+            return true;
+        }
+        _decode_scale = 1;
+    }
+
+    unsigned char* data = stbi_load_from_memory(bytes, file.size(), 
+                                                &_width, &_height, &n, CHANNELS);
+    if (data == nullptr) {
+        return false;
     }
-    stbi_image_free(data);
+    _image = pixel_buffer(data, stbi_image_free);
+    _source_width = _width;
+    _source_height = _height;
+    _stage_keys[decode] = key;
+    _valid_stages |= 1u << decode;
     
-    return (data != nullptr);
+    return true;
 }
 
 void Image::load_live(const Mat & frame) {
     // Get frame dimensions
     _height = frame.rows;
     _width = frame.cols;
+    _source_height = _height;
+    _source_width = _width;
+    _decode_scale = 1;
+    _frame_version++;
+    _cache_misses[static_cast<int>(Stage::decode)]++;
+    _stage_keys[static_cast<int>(Stage::decode)] = decode_key(1);
+    _valid_stages = 1u << static_cast<int>(Stage::decode);
     size_t totalBytes = frame.total() * frame.elemSize();
     
-    _image.resize(totalBytes);
+    _image = pixel_buffer(static_cast<unsigned char *>(malloc(totalBytes)), free);
     
-    memcpy(_image.data(), frame.data, totalBytes);
+    if (_color_mode == ColorMode::none) {
+        memcpy(_image.get(), frame.data, totalBytes);
+        return;
+    }
+    // OpenCV frames are BGR, swap while copying so colours come out right
+    const unsigned char *src = frame.data;
+    unsigned char *dest = _image.get();
+    for (size_t i = 0; i < totalBytes; i += CHANNELS) {
+        dest[i + 0] = src[i + 2];
+        dest[i + 1] = src[i + 1];
+        dest[i + 2] = src[i + 0];
+    }
 }
 
-bool Image::load_palette() {
-    vector<unsigned char> _palette_1D;
-    vector<vector<unsigned char>> palette_row;
-    vector<unsigned char> pixel;
-    size_t RGBA = 3;
-    string palette_file = "palette.png";
+/**
+ * @brief Switches the characters the image is drawn with
+ * 
+ * @param palette - palette to copy, needs its atlas loaded for png output
+ */
+void Image::set_palette(const Palette& palette) {
+    _palette = palette;
+    _palette_version++;
+    build_lumin_lut();
+}
 
-    int n;
-    unsigned char* data = stbi_load(palette_file.c_str(),&_palette_width,&_palette_height,&n, 3);
-    if (data != nullptr) {
-        _palette_1D = vector<unsigned char>(data, data + _palette_width * _palette_height * 3);
-    }
-    stbi_image_free(data);
-    if (data == nullptr) {
-        return false;
+/**
+ * @brief Finds the average luminance and colour of an area of the image 
+ *        based on the scalar, both in the same pass over the pixels. The 
+ *        common block sizes get their own copy of the kernel with the size 
+ *        known at compile time, so the loops unroll and the divisions 
+ *        become shifts
+ * 
+ * @param x_pos - x position of the pixel 
+ * @param y_pos - y position of the pixel
+ * @param color - average colour of the area
+ * @param quarter_sums - luminance sums of the area's four quarters for 
+ *                       shape_key(), or nullptr
+ * @return int - average luminance
+ */
+int Image::convolve(const int& x_pos, const int& y_pos, Rgb& color, 
+                    int *quarter_sums) const {
+    switch (_block_size) {
+    case 1:
+        return convolve_block<1>(x_pos, y_pos, color, quarter_sums);
+    case 2:
+        return convolve_block<2>(x_pos, y_pos, color, quarter_sums);
+    case 4:
+        return convolve_block<4>(x_pos, y_pos, color, quarter_sums);
+    case 8:
+        return convolve_block<8>(x_pos, y_pos, color, quarter_sums);
+    case 16:
+        return convolve_block<16>(x_pos, y_pos, color, quarter_sums);
+    default:
+        return convolve_block<0>(x_pos, y_pos, color, quarter_sums);
     }
-    
-    for (int i = 0; i < _palette_height; i++) {
-        for (int j = 0; j < _palette_width; j++) {
-            size_t index = RGBA * (i * _palette_width + j);
-            pixel.push_back(static_cast<int>(_palette_1D[index + 0]));
-            pixel.push_back(static_cast<int>(_palette_1D[index + 1]));
-            pixel.push_back(static_cast<int>(_palette_1D[index + 2]));
+}
+
+/**
+ * @brief convolve() for blocks BLOCK pixels wide, or _block_size when BLOCK 
+ *        is 0, and _cell_aspect times as high
+ */
+template <int BLOCK>
+int Image::convolve_block(const int& x_pos, const int& y_pos, Rgb& color, 
+                          int *quarter_sums) const {
+    const size_t RGBA = 3;
+    const int block_size = (BLOCK != 0) ? BLOCK : _block_size;
+    const int block_height = block_size * _cell_aspect;
+    const unsigned char *image = _image.get();
+    int r, g, b;
+    int avg_lumin = 0;
+    int r_sum = 0;
+    int g_sum = 0;
+    int b_sum = 0;
+    int sums[4] = {};
+    int mid = max(1, block_size / 2);
+    int mid_row = max(1, block_height / 2);
+
+    for (int i = 0; i < block_height; i++) {
+        size_t index = RGBA * ((y_pos * block_height + i) * _width + (x_pos * block_size));
+        int *halves = &sums[(i < mid_row) ? 0 : 2];
+        for (int j = 0; j < block_size; j++, index += RGBA) {
+            r = static_cast<int>(image[index + 0]);
+            g = static_cast<int>(image[index + 1]);
+            b = static_cast<int>(image[index + 2]);
 
-            
-            palette_row.push_back(pixel);
-            pixel.clear();
+            halves[j >= mid] += (r + g + b) / 3;
+            r_sum += r;
+            g_sum += g;
+            b_sum += b;
         }
-        _palette.push_back(palette_row);
-        palette_row.clear();
+    }
+    avg_lumin = sums[0] + sums[1] + sums[2] + sums[3];
+    if (quarter_sums != nullptr) {
+        copy(sums, sums + 4, quarter_sums);
     }
 
-    return true;
+    int block_area = block_size * block_height;
+    color.r = r_sum / block_area;
+    color.g = g_sum / block_area;
+    color.b = b_sum / block_area;
+    avg_lumin = avg_lumin / block_area;
+    return avg_lumin;
 }
 
 /**
- * @brief Finds the average luminance of an area of the iamge based on the scalar
+ * @brief Builds the summed area table of the decoded image: entry (x, y) 
+ *        holds the sums of every pixel above and left of it, grey first and
+ *        then r, g, b when colour is on. Sums wrap at 32 bits, which is fine
+ *        as long as no single cell adds up to more than that
+ */
+void Image::integral_image() {
+    _integral_planes = (_color_mode != ColorMode::none) ? 4 : 1;
+    size_t stride = static_cast<size_t>(_width + 1) * _integral_planes;
+    _integral.assign(stride * (_height + 1), 0);
+
+    const unsigned char *pix = _image.get();
+    for (int y = 0; y < _height; y++) {
+        const uint32_t *above = &_integral[y * stride];
+        uint32_t *sums = &_integral[(y + 1) * stride];
+        uint32_t row_sums[4] = {};
+        for (int x = 0; x < _width; x++, pix += CHANNELS) {
+            row_sums[0] += (pix[0] + pix[1] + pix[2]) / 3;
+            row_sums[1] += pix[0];
+            row_sums[2] += pix[1];
+            row_sums[3] += pix[2];
+            size_t index = static_cast<size_t>(x + 1) * _integral_planes;
+            for (int plane = 0; plane < _integral_planes; plane++) {
+                sums[index + plane] = above[index + plane] + row_sums[plane];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Sum of one plane over the pixels [x0, x1) by [y0, y1)
  * 
- * @param x_pos - x position of the pixel 
- * @param y_pos - y position of the pixel
+ * @param plane - 0 grey, 1 to 3 r, g, b
+ * @return int 
+ */
+int Image::area_sum(const int& plane, const int& x0, const int& y0, 
+                    const int& x1, const int& y1) const {
+    size_t stride = static_cast<size_t>(_width + 1) * _integral_planes;
+    const uint32_t *top = &_integral[y0 * stride + plane];
+    const uint32_t *bottom = &_integral[y1 * stride + plane];
+    return static_cast<int>(bottom[x1 * _integral_planes] - bottom[x0 * _integral_planes] - 
+                            top[x1 * _integral_planes] + top[x0 * _integral_planes]);
+}
+
+/**
+ * @brief Same as convolve(), through the summed area table
+ * 
+ * @param x_pos - x position of the cell
+ * @param y_pos - y position of the cell
+ * @param color - average colour of the area
+ * @param quarter_sums - luminance sums of the area's four quarters, or nullptr
  * @return int - average luminance
  */
-int Image::convolve(const int& x_pos, const int& y_pos) const {
-    const size_t RGBA = 3;
-    int r, g, b;
-    int avg_lumin = 0;
+int Image::convolve_integral(const int& x_pos, const int& y_pos, Rgb& color, 
+                             int *quarter_sums) const {
+    int x0 = x_pos * _block_size;
+    int y0 = y_pos * _block_height;
+    int x1 = x0 + _block_size;
+    int y1 = y0 + _block_height;
+    int block_area = _block_size * _block_height;
 
-    for (int i = (y_pos * _scalar); i < (_scalar * (y_pos + 1)); i++) {
-        for (int j = (x_pos * _scalar); j < (_scalar * (x_pos + 1)); j++) {
-            size_t index = RGBA * (i * _width + j);
-            r = static_cast<int>(_image[index + 0]);
-            g = static_cast<int>(_image[index + 1]);
-            b = static_cast<int>(_image[index + 2]);
-
-            avg_lumin += (r + g + b) / 3;
-        }
+    if (_integral_planes > 1) {
+        color.r = area_sum(1, x0, y0, x1, y1) / block_area;
+        color.g = area_sum(2, x0, y0, x1, y1) / block_area;
+        color.b = area_sum(3, x0, y0, x1, y1) / block_area;
     }
-
-    avg_lumin = avg_lumin / (_scalar * _scalar);
-    return avg_lumin;
+    if (quarter_sums != nullptr) {
+        int xm = x0 + max(1, _block_size / 2);
+        int ym = y0 + max(1, _block_height / 2);
+        quarter_sums[0] = area_sum(0, x0, y0, xm, ym);
+        quarter_sums[1] = area_sum(0, xm, y0, x1, ym);
+        quarter_sums[2] = area_sum(0, x0, ym, xm, y1);
+        quarter_sums[3] = area_sum(0, xm, ym, x1, y1);
+    }
+    return area_sum(0, x0, y0, x1, y1) / block_area;
 }
 
 /**
- * @brief Scales the image and greyscales it
+ * @brief Scales the image and greyscales it, keeping each cell's colour in 
+ *        _color_image when colour output is on
  */
 void Image::scaled_greyscale_image() {
+    if (_resample) {
+        resample();
+        return;
+    }
     vector<int> greyscale_row;
+    vector<Rgb> color_row;
+    bool keep_color = (_color_mode != ColorMode::none);
+    greyscale_row.reserve(_scaled_width);
+    _greyscale_image.clear();
+    _greyscale_image.reserve(_scaled_height);
+    _color_image.clear();
+    _shape_keys.clear();
+    if (keep_color) {
+        color_row.reserve(_scaled_width);
+        _color_image.reserve(_scaled_height);
+    }
+    bool keep_shape = (_glyph_mode == GlyphMode::shape);
+    vector<int> shape_row;
+    if (keep_shape) {
+        shape_row.reserve(_scaled_width);
+        _shape_keys.reserve(_scaled_height);
+    }
     
+    Rgb color;
+    int quarter_sums[4];
     for (int i = 0; i < _scaled_height; i++) {
         for (int j = 0; j < _scaled_width; j++) {
-            int greyscale_pix = convolve(j, i);
+            int *quarters = keep_shape ? quarter_sums : nullptr;
+            int greyscale_pix = _integral_image ? convolve_integral(j, i, color, quarters) : 
+                                                  convolve(j, i, color, quarters);
             greyscale_row.push_back(greyscale_pix);
+            if (keep_color) {
+                color_row.push_back(color);
+            }
+            if (keep_shape) {
+                shape_row.push_back(shape_key(quarter_sums));
+            }
         }
         _greyscale_image.push_back(greyscale_row);
         greyscale_row.clear();
+        if (keep_shape) {
+            _shape_keys.push_back(shape_row);
+            shape_row.clear();
+        }
+        if (keep_color) {
+            _color_image.push_back(color_row);
+            color_row.clear();
+        }
     }
 }
 
+/**
+ * @brief scaled_greyscale_image() for a set_grid() grid: an area weighted 
+ *        box filter over the half cells from the weight tables, one source 
+ *        row at a time. Each row is resampled across once and added into 
+ *        the one or two half cell rows it overlaps
+ */
+void Image::resample() {
+    bool keep_color = (_color_mode != ColorMode::none);
+    bool keep_shape = (_glyph_mode == GlyphMode::shape);
+    int planes = keep_color ? 4 : 1;
+    int half_cols = _scaled_width * 2;
+    // every half cell's weights add up to _width * _height
+    int64_t half_area = static_cast<int64_t>(_width) * _height;
+
+    size_plane(_greyscale_image, _scaled_height, _scaled_width, 0);
+    size_plane(_color_image, keep_color ? _scaled_height : 0, _scaled_width, Rgb());
+    size_plane(_shape_keys, keep_shape ? _scaled_height : 0, _scaled_width, 0);
+
+    vector<int>& across = _across;
+    int64_t *halves = _halves.data();
+    int across_y = -1;
+    const unsigned char *image = _image.get();
+
+    for (int i = 0; i < _scaled_height; i++) {
+        fill(halves, halves + (2 * half_cols * planes), 0);
+        for (int half = 0; half < 2; half++) {
+            const Span& row_span = _row_spans[(i * 2) + half];
+            int64_t *sums = &halves[half * half_cols * planes];
+            for (size_t k = 0; k < row_span.weights.size(); k++) {
+                int y = row_span.first + k;
+                // the last row of one half is often the first of the next
+                if (y != across_y) {
+                    const unsigned char *row = image + (static_cast<size_t>(y) * _width * CHANNELS);
+                    if (keep_color) {
+                        resample_row<4>(row, across);
+                    } else {
+                        resample_row<1>(row, across);
+                    }
+                    across_y = y;
+                }
+                int64_t weight = row_span.weights[k];
+                for (int c = 0; c < (half_cols * planes); c++) {
+                    sums[c] += weight * across[c];
+                }
+            }
+        }
+
+        for (int j = 0; j < _scaled_width; j++) {
+            // top left, top right, bottom left, bottom right
+            const int64_t *quarter[4] = {
+                &halves[(j * 2) * planes], &halves[((j * 2) + 1) * planes], 
+                &halves[(half_cols + (j * 2)) * planes], 
+                &halves[(half_cols + (j * 2) + 1) * planes]};
+            int64_t cell[4] = {};
+            for (int q = 0; q < 4; q++) {
+                for (int plane = 0; plane < planes; plane++) {
+                    cell[plane] += quarter[q][plane];
+                }
+            }
+            _greyscale_image[i][j] = cell[0] / (4 * half_area);
+            if (keep_color) {
+                _color_image[i][j].r = cell[1] / (4 * half_area);
+                _color_image[i][j].g = cell[2] / (4 * half_area);
+                _color_image[i][j].b = cell[3] / (4 * half_area);
+            }
+            if (keep_shape) {
+                int quarters[4];
+                for (int q = 0; q < 4; q++) {
+                    quarters[q] = quarter[q][0] / half_area;
+                }
+                _shape_keys[i][j] = Palette::shape_key(quarters);
+            }
+        }
+    }
+}
 
 /**
- * @brief Convolves the kernel with the _greyscale_image at pixel x_pos y_pos
+ * @brief Resamples one source row across into half cells, grey then r, g, 
+ *        b when PLANES is 4. A row's weights add up to _width, so the sums 
+ *        fit an int
  * 
- * @param x_pos - x position of the pixel being convolved
- * @param y_pos - y position of the pixel being convolved
- * @param kernel - kernel to do the convolution
- * @return double - sum total after convolution
+ * @param row - decoded pixels of the row
+ * @param across - weighted sums, PLANES per half cell
  */
-double Image::convolve(const int& x_pos, const int& y_pos, 
-                       const vector<vector<int>>& kernel) {
-    int kernel_size = kernel.size();
-    double total = 0.0;
-    for (int i = 0; i < kernel_size; i++) {
-        for (int j = 0; j < kernel_size; j++) {
-            total += _greyscale_image[y_pos + i - (kernel_size / 2)][x_pos + j - 
-            (kernel_size / 2)] * kernel[i][j];
+template <int PLANES>
+void Image::resample_row(const unsigned char *row, vector<int>& across) const {
+    for (size_t c = 0; c < _column_spans.size(); c++) {
+        const Span& span = _column_spans[c];
+        const unsigned char *pix = row + (span.first * CHANNELS);
+        int sums[PLANES] = {};
+        for (int weight : span.weights) {
+            sums[0] += weight * ((pix[0] + pix[1] + pix[2]) / 3);
+            if (PLANES > 1) {
+                sums[1] += weight * pix[0];
+                sums[2] += weight * pix[1];
+                sums[3] += weight * pix[2];
+            }
+            pix += CHANNELS;
         }
+        copy(sums, sums + PLANES, &across[c * PLANES]);
     }
-    return (total);
 }
 
 /**
- * @brief Convolves matrix with kernel at x_pos y_pos of matrix
+ * @brief Convolves rows with kernel at x_pos of the middle row
  * 
- * @param matrix - 2d array
+ * @param rows - the kernel.size() rows centred on the one convolved
  * @param x_pos - x position to convolve
- * @param y_pos - y position to convolve
  * @param kernel - kernel to convolve with
  * @return int - adjusted total
  */
-int Image::convolve(const vector<vector<int>>& matrix, const int& x_pos, 
-                    const int& y_pos, const vector<int>& kernel) {
+int Image::convolve(const vector<int> * const *rows, const int& x_pos, 
+                    const vector<int>& kernel) const {
 
     int total = 0;
     int kernel_size = kernel.size();
-    int kernel_sum = pow(2, 2 * (kernel_size + 1));
+    // binomial kernels sum to 2^(size - 1), squared for both directions
+    int kernel_sum = 1 << (2 * (kernel_size - 1));
     for (int i = 0; i < kernel_size; i++) {
+        const vector<int>& row = *rows[i];
         for (int j = 0; j < kernel_size; j++) {
-            total += matrix[y_pos + i - (kernel_size / 2)][x_pos + j - 
-            (kernel_size / 2)] * (kernel[i] * kernel[j]);
+            total += row[x_pos + j - (kernel_size / 2)] * (kernel[i] * kernel[j]);
         }
     }
     total = total / kernel_sum;
@@ -279,31 +1745,32 @@ int Image::convolve(const vector<vector<int>>& matrix, const int& x_pos,
 }
 
 /**
- * @brief Detects edges at x_pos y_pos and gives the angle of the edge
+ * @brief Buckets a gradient into one of the four edge directions without 
+ *        atan: the angle of Gy / Gx is compared against 18 and 72 degrees by
+ *        comparing |Gy| with tan-scaled |Gx| in fixed point
  * 
- * @param x_pos - x position of pixel to check
- * @param y_pos - y position of pixel to check
- * @param theta - angle of edge [0, 1]
- * @return true - if there is an edge
- * @return false - if there is not an edge
+ * @param gx - horizontal gradient
+ * @param gy - vertical gradient
+ * @return int - 0 horizontal, 1 and 3 diagonal, 2 vertical
  */
-bool Image::sobel(const int& x_pos, const int& y_pos, double& theta) {
-    vector<vector<int>> x_kernel = {{-1, 0, 1},
-                                    {-2, 0, 2},
-                                    {-1, 0, 1}};
-
-    vector<vector<int>> y_kernel = {{-1, -2, -1},
-                                    { 0,  0,  0},
-                                    { 1,  2,  1}};
-
-    double Gx = convolve(x_pos, y_pos, x_kernel) + 0.0001;
-    double Gy = convolve(x_pos, y_pos, y_kernel);
-
-    if (sqrt((Gx * Gx) + (Gy * Gy)) > 400) {
-        theta = (atan(Gy / Gx) / M_PI) + 0.5;
-        return true;
+int Image::edge_direction(const int& gx, const int& gy) {
+    // tan(72) and tan(18) degrees in 20 bit fixed point
+    const int64_t TAN_72 = 3227185;
+    const int64_t TAN_18 = 340703;
+    if (gy == 0) {
+        return 2;
+    }
+    int64_t scaled_y = static_cast<int64_t>(abs(gy)) << 20;
+    int64_t abs_x = abs(gx);
+    if (scaled_y > (TAN_72 * abs_x)) {
+        return 0;
+    }
+    if (scaled_y < (TAN_18 * abs_x)) {
+        return 2;
     }
-    return false;
+    // Gx of 0 counts as positive, like the old Gx + 0.0001
+    bool negative = (gy > 0) != (gx >= 0);
+    return negative ? 1 : 3;
 }
 
 /**
@@ -314,114 +1781,183 @@ bool Image::sobel(const int& x_pos, const int& y_pos, double& theta) {
  */
 void Image::gaussian_blur(vector<vector<int>>& blurred_image, 
                           const vector<int>& kernel) {
-    vector<int> blurred_image_row;
-    int border = (kernel.size() / 2) - 1;
-    
-    int blur;
+    size_plane(blurred_image, _scaled_height, _scaled_width, 0);
+    int radius = kernel.size() / 2;
+    vector<const vector<int> *> rows(kernel.size());
 
     for (int i = 0; i < _scaled_height; i++) {
-        for (int j = 0; j < _scaled_width; j++) {
-            if (!(((i - border) <= 0) || ((j - border) <= 0) || 
-                  ((i + border) >= (_scaled_height - 1)) || 
-                  ((j + border) >= (_scaled_width - 1)))) {
-                
-                blur = convolve(_greyscale_image, j, i, kernel);
-                blurred_image_row.push_back(blur);
-            } else {
-                blurred_image_row.push_back(0);
-            }
+        for (int k = 0; k < static_cast<int>(kernel.size()); k++) {
+            int y = i + k - radius;
+            rows[k] = ((y >= 0) && (y < _scaled_height)) ? &_greyscale_image[y] : nullptr;
+        }
+        blur_row(rows.data(), kernel, i, blurred_image[i]);
+    }
+}
+
+/**
+ * @brief Blurs row y_pos of the greyscale, leaving the cells the kernel 
+ *        doesn't fit around at 0
+ * 
+ * @param rows - the kernel.size() greyscale rows centred on y_pos, only read 
+ *               when the kernel fits
+ * @param kernel - how much u wanna blur?
+ * @param y_pos - row being blurred
+ * @param blurred - where the row goes
+ */
+void Image::blur_row(const vector<int> * const *rows, const vector<int>& kernel, 
+                     const int& y_pos, vector<int>& blurred) const {
+    blurred.assign(_scaled_width, 0);
+    int border = (kernel.size() / 2) - 1;
+    if (((y_pos - border) <= 0) || ((y_pos + border) >= (_scaled_height - 1))) {
+        return;
+    }
+    for (int j = 0; j < _scaled_width; j++) {
+        if (!(((j - border) <= 0) || ((j + border) >= (_scaled_width - 1)))) {
+            blurred[j] = convolve(rows, j, kernel);
         }
-        blurred_image.push_back(blurred_image_row);
-        blurred_image_row.clear();
     }
 }
 
+/**
+ * @brief Blurs the greyscale with kernel sizes of 5 and 9 into _blur_1 and
+ *        _blur_2 for dog()
+ */
+void Image::blur() {
+    gaussian_blur(_blur_1, DOG_KERNEL_1);
+    gaussian_blur(_blur_2, DOG_KERNEL_2);
+}
+
 /**
  * @brief Summons the Devourer of-- sorry, preforms a simple difference of 
- *        gaussians with a threshold of 9 and kernel sizes of 3 and 7
+ *        the gaussians from blur(), marking cells whose blurs differ by more
+ *        than _dog_threshold. Sobel reads it in place of the greyscale when 
+ *        edges come from the DoG
  */
 void Image::dog() {
-    vector<int> kernel_1 = {1, 4, 6, 4, 1};  
+    size_plane(_dog, _scaled_height, _scaled_width, 0);
+    for (int i = 0; i < _scaled_height; i++) {
+        dog_row(_blur_1[i], _blur_2[i], i, _dog[i]);
+    }
+}
 
-    vector<int> kernel_2 = {1, 8, 28, 56, 70, 56, 28, 8, 1};
+/**
+ * @brief One row of dog()
+ * 
+ * @param blur_1 - row y_pos of the narrower blur
+ * @param blur_2 - row y_pos of the wider blur
+ * @param y_pos - row being differenced
+ * @param dog - where the row goes, 255 where the blurs differ enough
+ */
+void Image::dog_row(const vector<int>& blur_1, const vector<int>& blur_2, 
+                    const int& y_pos, vector<int>& dog) const {
+    // the wider blur is left at 0 near the border, so nothing there counts
+    int border = DOG_KERNEL_2.size() / 2;
+    dog.assign(_scaled_width, 0);
+    if ((y_pos < border) || (y_pos >= (_scaled_height - border))) {
+        return;
+    }
+    for (int j = border; j < (_scaled_width - border); j++) {
+        if (abs(blur_1[j] - blur_2[j]) > _dog_threshold) {
+            dog[j] = 255;
+        }
+    }
+}
 
-    vector<vector<int>> blur_1;
-    vector<vector<int>> blur_2;
+const ColorQuantizer *Image::_curses_colors = nullptr;
 
-    gaussian_blur(blur_1, kernel_1);
-    gaussian_blur(blur_2, kernel_2);
+/**
+ * @brief Sets up one curses colour pair per colour the terminal can show, 
+ *        xterm's 256 colours when there are enough pairs for them and the 8 
+ *        basic colours otherwise. Black is drawn in a dark grey, or white 
+ *        when the terminal has no grey, since black glyphs would vanish into
+ *        the black background. Call after initscr
+ */
+void Image::init_curses_colors() {
+    if (!has_colors()) {
+        return;
+    }
+    start_color();
+    const ColorQuantizer& xterm256 = ColorQuantizer::xterm256();
+    bool use_256 = (COLORS >= 256) && (COLOR_PAIRS > xterm256.size());
+    _curses_colors = use_256 ? &xterm256 : &ColorQuantizer::basic8();
+    short black = use_256 ? XTERM_CUBE_BLACK : COLOR_BLACK;
+    short dark_grey = use_256 ? XTERM_DARK_GREY : 
+                                ((COLORS > BRIGHT_BLACK) ? BRIGHT_BLACK : COLOR_WHITE);
 
-    vector<int> dog_row;
-    for (int i = 0; i < _scaled_height; i++) {
-        for (int j = 0; j < _scaled_width; j++) {
-            if (abs(blur_1[i][j] - blur_2[i][j]) > _dog_threshold) {
-                dog_row.push_back(255);
-            } else {
-                dog_row.push_back(0);
-            }
-        }
-        _dog.push_back(dog_row);
-        dog_row.clear();
+    for (int i = 0; i < _curses_colors->size(); i++) {
+        short color = _curses_colors->color_number(i);
+        init_pair(i + 1, (color == black) ? dark_grey : color, COLOR_BLACK);
     }
 }
 
-char Image::get_edge_character(double theta) {
-    if ((theta < 0.1) || (theta > 0.9)) {
-        return _ascii_palette[10];
-    } else if (theta < 0.4) {
-        return _ascii_palette[11];
-    } else if (theta < 0.6) {
-        return _ascii_palette[12];
-    } else {
-        return _ascii_palette[13];
+/**
+ * @brief Gets the curses attribute for a cell's colour through the colour 
+ *        pair cube set up by init_curses_colors()
+ * 
+ * @param color - average colour of the cell
+ * @return chtype - colour pair attribute, 0 when colour is off
+ */
+chtype Image::curses_color(const Rgb& color) const {
+    if ((_color_mode == ColorMode::none) || (_curses_colors == nullptr)) {
+        return 0;
     }
+    return COLOR_PAIR(_curses_colors->index(color) + 1);
 }
 
-void Image::to_curses_helper(vector<string>& screen_lines, int start, int end) {
-    double theta = 0;
-    int avg_lumin = 0;
-    int ascii_idx = 0;
-    
+/**
+ * @brief Fits the grid to the window and sizes the line buffers, but only 
+ *        when nothing has been planned yet, the window was resized or the 
+ *        frame size changed. Steady frames skip straight past it
+ * 
+ * @param win - window to draw in
+ */
+void Image::plan_curses(WINDOW * win) {
+    if (_curses_planned && (_planned_width == _width) && (_planned_height == _height)) {
+        return;
+    }
+    int win_height, win_width;
+    getmaxyx(win, win_height, win_width);
+    fit_grid(win_width, win_height, CURSES_CELL_ASPECT);
+
+    _x_offset = (win_width - _scaled_width) / 2;
+    _y_offset = (win_height - _scaled_height) / 2;
+    _screen_lines.assign(_scaled_height, vector<chtype>(_scaled_width));
+    _planned_width = _width;
+    _planned_height = _height;
+    _curses_planned = true;
+    // whatever the old geometry drew around the image is stale now
+    werase(win);
+}
+
+/**
+ * @brief Call on KEY_RESIZE (curses' SIGWINCH) so the next to_curses or 
+ *        to_curses_multithread frame fits the new window size
+ */
+void Image::resize_curses() {
+    _curses_planned = false;
+}
+
+void Image::to_curses_helper(vector<vector<chtype>>& screen_lines, int start, int end) {
     for (int row = start; row < end; row++) {
-        screen_lines[row].reserve(_scaled_width * 2);
+        const vector<int>& indeces = _ascii_indeces[row];
+        chtype *line = screen_lines[row].data();
         
         for (int j = 0; j < _scaled_width; j++) {
-            bool is_border = (row == 0) || (j == 0) || (row == _scaled_height - 1) || (j == _scaled_width - 1);
-            bool is_dark = _greyscale_image[row][j] < 192;
-            
-            char char_to_add;
-            if (!is_border && sobel(j, row, theta) && is_dark) {
-                char_to_add = get_edge_character(theta);
-            } else {
-                avg_lumin = _greyscale_image[row][j] * 100;
-                ascii_idx = (avg_lumin / (25500 / (_num_quantized_lumin - 1)));
-                char_to_add = _ascii_palette[ascii_idx];
+            chtype ch = static_cast<unsigned char>(_palette.character(indeces[j]));
+            if (_color_mode != ColorMode::none) {
+                ch |= curses_color(_color_image[row][j]);
             }
-            
-            screen_lines[row].append(2, char_to_add);
+            line[j] = ch;
         }
     }
 }
 
 void Image::to_curses_multithread(WINDOW * win) {
-    int win_height, win_width;
-    getmaxyx(win, win_height, win_width);
-    win_width /= 2;
-    double win_aspect = static_cast<double>(win_width) / win_height;
-    double img_aspect = static_cast<double>(_width) / _height;
-
-    _scalar = ((img_aspect > win_aspect) ? (_width / win_width) : (_height / win_height)) + 1;
-    _scaled_width = _width / _scalar;
-    _scaled_height = _height / _scalar;
-
-    int x_offset = (win_width - _scaled_width);
-    int y_offset = (win_height - _scaled_height) / 2;
-
-    scaled_greyscale_image();
-    dog();
+    plan_curses(win);
+    run_stages(Stage::classify);
     
-    vector<string> screen_lines(_scaled_height);
     vector<thread> thread_grp;
+    thread_grp.reserve(NUM_THREADS);
     
     int lines_per_thread = _scaled_height / NUM_THREADS;
     int remaining_lines = _scaled_height % NUM_THREADS;
@@ -432,7 +1968,7 @@ void Image::to_curses_multithread(WINDOW * win) {
         int thread_end = current_start + thread_lines;
         
         thread_grp.emplace_back(&Image::to_curses_helper, this, 
-                               ref(screen_lines), 
+                               ref(_screen_lines), 
                                current_start, 
                                thread_end);
         
@@ -444,60 +1980,62 @@ void Image::to_curses_multithread(WINDOW * win) {
     }
     
     for (int i = 0; i < _scaled_height; i++) {
-        mvwaddstr(win, i + y_offset, x_offset, screen_lines[i].c_str());
+        mvwaddchnstr(win, i + _y_offset, _x_offset, _screen_lines[i].data(), 
+                     _screen_lines[i].size());
     }
     
     wrefresh(win);
 }
 
-void Image::to_curses(WINDOW * win) {
+/**
+ * @brief Draws the image at a given scalar, centred and cropped to the 
+ *        window, for when the scalar is picked by the user rather than to 
+ *        fit. Only the stages a change affects are redone
+ * 
+ * @param win - window to draw in
+ * @param scalar - how much to down scale the image across, cells are twice
+ *                 that high
+ */
+void Image::to_curses_scaled(WINDOW * win, const int& scalar) {
     int win_height, win_width;
     getmaxyx(win, win_height, win_width);
-    win_width /= 2;
-    double win_aspect = static_cast<double>(win_width) / win_height;
-    double img_aspect = static_cast<double>(_width) / _height;
 
-    _scalar = ((img_aspect > win_aspect) ? (_width / win_width) : (_height / win_height)) + 1;
-    _scaled_width = _width / _scalar;
-    _scaled_height = _height / _scalar;
+    set_scalar(scalar, CURSES_CELL_ASPECT);
+    run_stages(Stage::classify);
 
-    int x_offset = (win_width - _scaled_width);
-    int y_offset = (win_height - _scaled_height) / 2;
+    int cells_wide = min(_scaled_width, win_width);
+    int rows = min(_scaled_height, win_height);
+    int x_offset = (win_width - cells_wide) / 2;
+    int y_offset = (win_height - rows) / 2;
+
+    werase(win);
+    vector<chtype> line(cells_wide);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cells_wide; j++) {
+            chtype ch = static_cast<unsigned char>(_palette.character(_ascii_indeces[i][j]));
+            if (_color_mode != ColorMode::none) {
+                ch |= curses_color(_color_image[i][j]);
+            }
+            line[j] = ch;
+        }
+        mvwaddchnstr(win, i + y_offset, x_offset, line.data(), line.size());
+    }
 
-    scaled_greyscale_image();
-    dog();
+    wrefresh(win);
+}
 
-    vector<int> _ascii_indeces_row;
+void Image::to_curses(WINDOW * win) {
+    plan_curses(win);
+    run_stages(Stage::classify);
 
-    int avg_lumin;
-    int ascii_idx;
-    double theta;
     for (int i = 0; i < _scaled_height; i++) {
+        const vector<int>& indeces = _ascii_indeces[i];
         for (int j = 0; j < _scaled_width; j++) {
-            bool is_border = (i == 0) || (j == 0) || (i == _scaled_height - 1)|| 
-                             (j == _scaled_width - 1);
-            bool is_dark = _greyscale_image[i][j] < 192;
-            if (!is_border && sobel(j, i, theta) && is_dark) {
-                
-                if ((theta < 0.1) || (theta > 0.9)) {
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset, _ascii_palette[10]);
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset + 1, _ascii_palette[10]);
-                } else if (theta < 0.4) {
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset, _ascii_palette[11]);
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset + 1, _ascii_palette[11]);
-                } else if (theta < 0.6) {
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset, _ascii_palette[12]);
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset + 1, _ascii_palette[12]);
-                } else {
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset, _ascii_palette[13]);
-                    mvwaddch(win, i + y_offset, (j * 2) + x_offset + 1, _ascii_palette[13]);
-                }
-            } else {
-                avg_lumin = _greyscale_image[i][j] * 100;
-                ascii_idx = (avg_lumin / (25500 / (_num_quantized_lumin - 1)));
-                mvwaddch(win, i + y_offset, (j * 2) + x_offset, _ascii_palette[ascii_idx]);
-                mvwaddch(win, i + y_offset, (j * 2) + x_offset + 1, _ascii_palette[ascii_idx]);
+            chtype ch = static_cast<unsigned char>(_palette.character(indeces[j]));
+            if (_color_mode != ColorMode::none) {
+                ch |= curses_color(_color_image[i][j]);
             }
+            mvwaddch(win, i + _y_offset, j + _x_offset, ch);
         }
     }
     
@@ -505,34 +2043,498 @@ void Image::to_curses(WINDOW * win) {
 }
 
 /**
- * @brief Instanciates the output array with the correct rgb values to be written
+ * @brief Builds the table that expands a byte of glyph mask into 8 RGB 
+ *        pixels worth of 0x00 (background) or 0xFF (foreground) bytes
+ */
+static constexpr array<array<unsigned char, 8 * CHANNELS>, 256> build_mask_expand() {
+    array<array<unsigned char, 8 * CHANNELS>, 256> table = {};
+    for (int bits = 0; bits < 256; bits++) {
+        for (int x = 0; x < 8; x++) {
+            for (int c = 0; c < CHANNELS; c++) {
+                table[bits][x * CHANNELS + c] = ((bits >> x) & 1) ? 0xFF : 0x00;
+            }
+        }
+    }
+    return table;
+}
+
+static constexpr array<array<unsigned char, 8 * CHANNELS>, 256> MASK_EXPAND = 
+    build_mask_expand();
+
+/**
+ * @brief Writes the _scalar * _cell_aspect pixel rows of glyphs for one row 
+ *        of ascii indeces, compositing the foreground and background colours through each 
+ *        glyph's mask. When glyphs aren't resized the mask is expanded a 
+ *        byte (8 pixels) at a time, and common scalars get a copy of the 
+ *        blit with the width known at compile time
+ * 
+ * @param writer - png being written
+ * @param indeces - palette index of every cell in the row
+ * @param raster_row - scratch space for one output row
+ * @param colors - foreground of every cell, nullptr for the palette's own
+ * @return true 
+ * @return false 
+ */
+bool Image::write_glyph_rows(PngWriter& writer, const vector<int>& indeces, 
+                             vector<unsigned char>& raster_row, 
+                             const vector<Rgb> *colors) const {
+    int cell_width = _palette.cell_width();
+    int cell_height = _palette.cell_height();
+    size_t cell_bytes = static_cast<size_t>(_scalar) * CHANNELS;
+    raster_row.resize(_scaled_width * cell_bytes);
+
+    // Map output columns back to glyph columns once instead of per pixel
+    vector<int> glyph_cols(_scalar);
+    for (int output_col = 0; output_col < _scalar; output_col++) {
+        glyph_cols[output_col] = (output_col * cell_width) / _scalar;
+    }
+
+    const Rgb& background = _palette.background();
+    unsigned char background_run[8 * CHANNELS];
+    for (int x = 0; x < 8; x++) {
+        unsigned char *bg = background_run + (x * CHANNELS);
+        bg[0] = background.r;
+        bg[1] = background.g;
+        bg[2] = background.b;
+    }
+
+    int output_height = _scalar * _cell_aspect;
+    for (int output_row = 0; output_row < output_height; output_row++) {  
+        int glyph_y = (output_row * cell_height) / output_height;
+        unsigned char *pix = raster_row.data();
+        switch (_scalar) {
+        case 2:
+            blit_glyph_row<2>(pix, indeces, glyph_y, glyph_cols.data(), colors, background_run);
+            break;
+        case 4:
+            blit_glyph_row<4>(pix, indeces, glyph_y, glyph_cols.data(), colors, background_run);
+            break;
+        case 8:
+            blit_glyph_row<8>(pix, indeces, glyph_y, glyph_cols.data(), colors, background_run);
+            break;
+        case 16:
+            blit_glyph_row<16>(pix, indeces, glyph_y, glyph_cols.data(), colors, background_run);
+            break;
+        default:
+            blit_glyph_row<0>(pix, indeces, glyph_y, glyph_cols.data(), colors, background_run);
+            break;
+        }
+        if (!writer.write_row(raster_row.data())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Fills one output row of a row of cells for write_glyph_rows(), for
+ *        cells SCALAR pixels wide, or _scalar when SCALAR is 0
+ * 
+ * @param pix - start of the output row
+ * @param indeces - palette index of every cell in the row
+ * @param glyph_y - glyph row this output row shows
+ * @param glyph_cols - glyph column each output column shows
+ * @param colors - foreground of every cell, nullptr for the palette's own
+ * @param background_run - 8 pixels of background
+ */
+template <int SCALAR>
+void Image::blit_glyph_row(unsigned char *pix, const vector<int>& indeces, 
+                           const int& glyph_y, const int *glyph_cols, 
+                           const vector<Rgb> *colors, 
+                           const unsigned char *background_run) const {
+    const int scalar = (SCALAR != 0) ? SCALAR : _scalar;
+    int cell_width = _palette.cell_width();
+    const Rgb& background = _palette.background();
+    unsigned char foreground_run[8 * CHANNELS];
+
+    for (int j = 0; j < _scaled_width; j++) {
+        uint64_t mask = _palette.glyph_row(indeces[j], glyph_y);
+        const Rgb& foreground = (colors != nullptr) ? (*colors)[j] : 
+                                                      _palette.foreground();
+
+        if (scalar == cell_width) {
+            for (int x = 0; x < 8; x++) {
+                unsigned char *fg = foreground_run + (x * CHANNELS);
+                fg[0] = foreground.r;
+                fg[1] = foreground.g;
+                fg[2] = foreground.b;
+            }
+            for (int x = 0; x < scalar; x += 8) {
+                const unsigned char *expand = MASK_EXPAND[(mask >> x) & 0xFF].data();
+                int run_bytes = min(8, scalar - x) * CHANNELS;
+                for (int k = 0; k < run_bytes; k++) {
+                    pix[k] = (foreground_run[k] & expand[k]) | 
+                             (background_run[k] & ~expand[k]);
+                }
+                pix += run_bytes;
+            }
+            continue;
+        }
+        for (int output_col = 0; output_col < scalar; output_col++) {
+            const Rgb& colour = ((mask >> glyph_cols[output_col]) & 1) ? 
+                                foreground : background;
+            pix[0] = colour.r;
+            pix[1] = colour.g;
+            pix[2] = colour.b;
+            pix += CHANNELS;
+        }
+    }
+}
+
+/**
+ * @brief Writes _ascii_indeces out as a png of glyphs one row at a time. 
+ *        Cells are drawn _scalar wide and as many times taller as the 
+ *        palette's glyphs, so the grid has to have been sampled with 
+ *        to_ascii_index(scalar, palette.cell_aspect())
+ * 
+ * @return true 
+ * @return false - if the png couldn't be written, no partial file is left, 
+ *                 or the grid's cells aren't the glyphs' shape
  */
-void Image::to_ascii_png() {
-    int output_size = (_scaled_width * _scalar) * (_scaled_height * _scalar) * CHANNELS;
-    _output = new unsigned char[output_size];
-    unsigned char *pix = _output;
+bool Image::to_ascii_png() {
+    PngWriter writer;
+    vector<unsigned char> raster_row;
 
+    if (_cell_aspect != _palette.cell_aspect()) {
+        return false;
+    }
+    if (!writer.open(_output_filename, _scaled_width * _scalar, 
+                     _scaled_height * _scalar * _cell_aspect)) {
+        return false;
+    }
     for (int i = 0; i < _scaled_height; i++) {
-        for (int output_row = 0; output_row < _scalar; output_row++) {  
-            // Map output row back to source palette row (0-7)
-            int palette_row = (output_row * 8) / _scalar;
-            
-            for (int j = 0; j < _scaled_width; j++) {
-                int ascii_texture_start_col = _ascii_indeces[i][j] * 8;  // Always 8, since palette chars are 8 wide
-                
-                for (int output_col = 0; output_col < _scalar; output_col++) {
-                    // Map output column back to source palette column (0-7 within the character)
-                    int palette_col = ascii_texture_start_col + (output_col * 8) / _scalar;
-                    
-                    for (int c = 0; c < 3; c++) {
-                        *(pix + c) = _palette[palette_row][palette_col][c];
+        const vector<Rgb> *colors = (_color_mode != ColorMode::none) ? 
+                                    &_color_image[i] : nullptr;
+        if (!write_glyph_rows(writer, _ascii_indeces[i], raster_row, colors)) {
+            return false;
+        }
+    }
+    return writer.close();
+}
+
+/**
+ * @brief Writes _ascii_indeces out as text. With colour on, an ANSI colour 
+ *        escape (24 bit, or xterm 256 through the lookup cube) starts each 
+ *        run of cells that share a colour rather than every character
+ * 
+ * @return true 
+ * @return false 
+ */
+bool Image::to_ascii_text() const {
+    ofstream out(_output_filename);
+    if (!out) {
+        return false;
+    }
+    bool color = (_color_mode != ColorMode::none);
+    const ColorQuantizer& xterm256 = ColorQuantizer::xterm256();
+
+    for (int i = 0; i < _scaled_height; i++) {
+        // colour of the current run, -1 before the first one
+        long run_color = -1;
+        for (int j = 0; j < _scaled_width; j++) {
+            if (color) {
+                const Rgb& c = _color_image[i][j];
+                long cell_color = (_color_mode == ColorMode::xterm256) ? 
+                                  xterm256.color_number(xterm256.index(c)) : 
+                                  ((c.r << 16) | (c.g << 8) | c.b);
+                if (cell_color != run_color) {
+                    if (_color_mode == ColorMode::xterm256) {
+                        out << "\x1b[38;5;" << cell_color << 'm';
+                    } else {
+                        out << "\x1b[38;2;" << static_cast<int>(c.r) << ';' 
+                            << static_cast<int>(c.g) << ';' << static_cast<int>(c.b) << 'm';
+                    }
+                    run_color = cell_color;
+                }
+            }
+            out << _palette.character(_ascii_indeces[i][j]);
+        }
+        out << (color ? "\x1b[0m\n" : "\n");
+    }
+    return out.good();
+}
+
+/**
+ * @brief Adds the greyscale (and colour) of one source row into the per cell
+ *        sums
+ * 
+ * @param source_row - RGB pixels of the row
+ * @param sums - running total for each cell in the current row of cells
+ * @param color_sums - running r, g, b totals for each cell, or nullptr
+ * @param quarter_sums - running quarter totals, four per cell, offset to the
+ *                       bottom pair when the row is in the bottom half, or 
+ *                       nullptr. Specialised for common block sizes like 
+ *                       convolve()
+ */
+void Image::accumulate_row(const unsigned char *source_row, vector<int>& sums, 
+                           vector<int> *color_sums, int *quarter_sums) const {
+    switch (_block_size) {
+    case 1:
+        return accumulate_row_block<1>(source_row, sums, color_sums, quarter_sums);
+    case 2:
+        return accumulate_row_block<2>(source_row, sums, color_sums, quarter_sums);
+    case 4:
+        return accumulate_row_block<4>(source_row, sums, color_sums, quarter_sums);
+    case 8:
+        return accumulate_row_block<8>(source_row, sums, color_sums, quarter_sums);
+    case 16:
+        return accumulate_row_block<16>(source_row, sums, color_sums, quarter_sums);
+    default:
+        return accumulate_row_block<0>(source_row, sums, color_sums, quarter_sums);
+    }
+}
+
+/**
+ * @brief accumulate_row() for blocks of BLOCK pixels, or _block_size when 
+ *        BLOCK is 0
+ */
+template <int BLOCK>
+void Image::accumulate_row_block(const unsigned char *source_row, vector<int>& sums, 
+                                 vector<int> *color_sums, int *quarter_sums) const {
+    const int block_size = (BLOCK != 0) ? BLOCK : _block_size;
+    int mid = max(1, block_size / 2);
+    for (int j = 0; j < _scaled_width; j++) {
+        const unsigned char *pix = source_row + (j * block_size * CHANNELS);
+        int r_sum = 0;
+        int g_sum = 0;
+        int b_sum = 0;
+        int halves[2] = {};
+        for (int k = 0; k < block_size; k++) {
+            halves[k >= mid] += (pix[0] + pix[1] + pix[2]) / 3;
+            r_sum += pix[0];
+            g_sum += pix[1];
+            b_sum += pix[2];
+            pix += CHANNELS;
+        }
+        sums[j] += halves[0] + halves[1];
+        if (color_sums != nullptr) {
+            (*color_sums)[j * CHANNELS + 0] += r_sum;
+            (*color_sums)[j * CHANNELS + 1] += g_sum;
+            (*color_sums)[j * CHANNELS + 2] += b_sum;
+        }
+        if (quarter_sums != nullptr) {
+            quarter_sums[j * 4 + 0] += halves[0];
+            quarter_sums[j * 4 + 1] += halves[1];
+        }
+    }
+}
+
+/**
+ * @brief Converts the image straight to a png a strip at a time: each row of 
+ *        cells is decoded, downscaled, classified and written before the 
+ *        next one is read. Only a few greyscale rows and their gradients 
+ *        are kept, so memory stays the same no matter how tall the image is. 
+ *        Edges from the blur or DoG wait for the greyscale rows around them, 
+ *        and with edge thinning each row also waits for the gradient of the 
+ *        row below. JPEGs 
+ *        are decoded by scanline, other formats still need a full decode. 
+ *        Cells are the shape of the palette's glyphs, as in to_ascii_png()
+ * 
+ * @param scalar - how much to down scale the image across
+ * @return true 
+ * @return false 
+ */
+bool Image::to_ascii_png_streamed(const int& scalar) {
+    if (_palette.cell_aspect() == 0) {
+        return false;
+    }
+    if (!_probed && !probe()) {
+        return false;
+    }
+    if ((_memory_budget != 0) && (planned_bytes(scalar, true) > _memory_budget)) {
+        return false;
+    }
+
+    MappedFile file(_filename);
+    if (file.data() == nullptr) {
+        return false;
+    }
+    // the decoded image and its planes are replaced row by row below
+    _valid_stages = 0;
+
+    JpegReader reader;
+    vector<unsigned char> source_row;
+    _decode_scale = 1;
+    // rows come from the reader or from a full decode, never from whatever an
+    // earlier load() left in _image
+    bool use_reader = _is_jpeg && reader.start(file.data(), file.size(), 
+                                               decode_scale_for(scalar));
+    if (use_reader) {
+        _image.reset();
+        _decode_scale = decode_scale_for(scalar);
+        _width = reader.width();
+        _height = reader.height();
+        source_row.resize(static_cast<size_t>(_width) * CHANNELS);
+    } else {
+        int n;
+        unsigned char* data = stbi_load_from_memory(file.data(), file.size(), 
+                                                    &_width, &_height, &n, CHANNELS);
+        if (data == nullptr) {
+            return false;
+        }
+        _image = pixel_buffer(data, stbi_image_free);
+        _source_width = _width;
+        _source_height = _height;
+    }
+    set_scalar(scalar, _palette.cell_aspect());
+
+    PngWriter writer;
+    if (!writer.open(_output_filename, _scaled_width * _scalar, 
+                     _scaled_height * _scalar * _cell_aspect)) {
+        return false;
+    }
+
+    bool keep_shape = (_glyph_mode == GlyphMode::shape);
+    // edges from the blur or the DoG are halo rows behind the greyscale, 
+    // which is kept long enough to blur and to classify once they are found
+    int halo = streamed_halo();
+    int depth = (2 * halo) + 3;
+    vector<vector<int>> window(depth, vector<int>(_scaled_width));
+    bool keep_color = (_color_mode != ColorMode::none);
+    vector<vector<int>> color_window(keep_color ? depth : 0, 
+                                     vector<int>(_scaled_width * CHANNELS));
+    vector<Rgb> colors(keep_color ? _scaled_width : 0);
+    vector<vector<int>> quarter_window(keep_shape ? depth : 0, vector<int>(_scaled_width * 4));
+    vector<int> keys(keep_shape ? _scaled_width : 0);
+    vector<int> indeces(_scaled_width);
+    bool diffuse = (_dither_mode == DitherMode::floyd_steinberg) || 
+                   (_dither_mode == DitherMode::atkinson);
+    // error pushed onto the rows that have not been classified yet
+    vector<vector<int>> pending(diffuse ? 3 : 0, vector<int>(_scaled_width, 0));
+    vector<int> levels(diffuse ? _scaled_width : 0);
+    // gradients of the last three rows. Thinning a row needs the row below's
+    // gradient too, so rows are classified one row later when it is on
+    vector<vector<int>> magnitude_window(3, vector<int>(_scaled_width, 0));
+    vector<vector<int>> direction_window(3, vector<int>(_scaled_width, 0));
+    // the last three rows of _blur_1 or _dog, the greyscale is read in place
+    vector<vector<int>> plane_window((halo > 0) ? 3 : 0, vector<int>(_scaled_width, 0));
+    vector<int> blur_1;
+    vector<int> blur_2;
+    vector<const vector<int> *> kernel_rows((2 * halo) + 1);
+    auto plane_row = [&](int row) -> const vector<int>& {
+        return (halo > 0) ? plane_window[row % 3] : window[row % depth];
+    };
+    int margin = edge_margin();
+    bool thin = _edge_thinning && !keep_shape;
+    vector<int> thinned(thin ? _scaled_width : 0);
+    int lag = thin ? 2 : 1;
+    vector<unsigned char> raster_row;
+    int block_area = _block_size * _block_height;
+    size_t source_stride = static_cast<size_t>(_width) * CHANNELS;
+
+    for (int i = 0; i < (_scaled_height + halo + lag); i++) {
+        if (i < _scaled_height) {
+            vector<int>& sums = window[i % depth];
+            vector<int> *color_sums = keep_color ? &color_window[i % depth] : nullptr;
+            fill(sums.begin(), sums.end(), 0);
+            if (keep_color) {
+                fill(color_sums->begin(), color_sums->end(), 0);
+            }
+            if (keep_shape) {
+                fill(quarter_window[i % depth].begin(), quarter_window[i % depth].end(), 0);
+            }
+            int mid = max(1, _block_height / 2);
+
+            for (int k = 0; k < _block_height; k++) {
+                const unsigned char *row;
+                if (use_reader) {
+                    if (!reader.read_row(source_row.data())) {
+                        return false;
                     }
-                    pix += CHANNELS;
+                    row = source_row.data();
+                } else {
+                    row = _image.get() + (static_cast<size_t>(i * _block_height + k) * source_stride);
+                }
+                int *quarter_sums = keep_shape ? &quarter_window[i % depth][(k < mid) ? 0 : 2] : nullptr;
+                accumulate_row(row, sums, color_sums, quarter_sums);
+            }
+            for (int j = 0; j < _scaled_width; j++) {
+                sums[j] /= block_area;
+            }
+        }
+
+        // row i - halo of the blur or DoG now has all the greyscale around it
+        int plane_pos = i - halo;
+        if ((halo > 0) && (plane_pos >= 0) && (plane_pos < _scaled_height)) {
+            for (int k = 0; k < static_cast<int>(kernel_rows.size()); k++) {
+                int y = plane_pos + k - halo;
+                kernel_rows[k] = ((y >= 0) && (y < _scaled_height)) ? &window[y % depth] : nullptr;
+            }
+            vector<int>& plane = plane_window[plane_pos % 3];
+            if (_edge_source == EdgeSource::blur) {
+                blur_row(kernel_rows.data(), DOG_KERNEL_1, plane_pos, plane);
+            } else {
+                int inset = halo - (DOG_KERNEL_1.size() / 2);
+                blur_row(kernel_rows.data() + inset, DOG_KERNEL_1, plane_pos, blur_1);
+                blur_row(kernel_rows.data(), DOG_KERNEL_2, plane_pos, blur_2);
+                dog_row(blur_1, blur_2, plane_pos, plane);
+            }
+        }
+
+        // the row above that now has both of its neighbours, rows within the 
+        // margin have no edges
+        int edge_row_pos = plane_pos - 1;
+        if (!keep_shape && (edge_row_pos >= 0) && (edge_row_pos < _scaled_height)) {
+            vector<int>& magnitudes = magnitude_window[edge_row_pos % 3];
+            vector<int>& directions = direction_window[edge_row_pos % 3];
+            if ((edge_row_pos < margin) || (edge_row_pos >= (_scaled_height - margin))) {
+                fill(magnitudes.begin(), magnitudes.end(), 0);
+            } else {
+                edge_row(plane_row(edge_row_pos - 1), plane_row(edge_row_pos), 
+                         plane_row(edge_row_pos + 1), window[edge_row_pos % depth], 
+                         magnitudes, directions);
+                for (int j = 1; (j < margin) && (j < _scaled_width); j++) {
+                    magnitudes[j] = 0;
+                    magnitudes[_scaled_width - 1 - j] = 0;
                 }
             }
         }
+
+        int cell_row = i - halo - lag;
+        if (cell_row < 0) {
+            continue;
+        }
+        const vector<int>& current = window[cell_row % depth];
+        const vector<int> *magnitudes = &magnitude_window[cell_row % 3];
+        const vector<int>& directions = direction_window[cell_row % 3];
+        if (thin) {
+            // the first and last rows are all 0 so never read their neighbours
+            thinned = *magnitudes;
+            suppress_row(magnitude_window[(cell_row + 2) % 3], *magnitudes, 
+                         magnitude_window[(cell_row + 1) % 3], directions, thinned);
+            magnitudes = &thinned;
+        }
+
+        if (keep_shape) {
+            const vector<int>& quarter_sums = quarter_window[cell_row % depth];
+            for (int j = 0; j < _scaled_width; j++) {
+                keys[j] = shape_key(&quarter_sums[j * 4]);
+            }
+            shape_row(keys, indeces);
+        } else if (diffuse) {
+            vector<int>& work = pending[cell_row % 3];
+            for (int j = 0; j < _scaled_width; j++) {
+                work[j] += current[j];
+            }
+            diffuse_row(work, &pending[(cell_row + 1) % 3], &pending[(cell_row + 2) % 3], 
+                        levels, [](int) {});
+            fill(work.begin(), work.end(), 0);
+            classify_row(current, cell_row, *magnitudes, directions, indeces, &levels);
+        } else {
+            classify_row(current, cell_row, *magnitudes, directions, indeces);
+        }
+        if (keep_color) {
+            const vector<int>& color_sums = color_window[cell_row % depth];
+            for (int j = 0; j < _scaled_width; j++) {
+                colors[j].r = color_sums[j * CHANNELS + 0] / block_area;
+                colors[j].g = color_sums[j * CHANNELS + 1] / block_area;
+                colors[j].b = color_sums[j * CHANNELS + 2] / block_area;
+            }
+        }
+        if (!write_glyph_rows(writer, indeces, raster_row, keep_color ? &colors : nullptr)) {
+            return false;
+        }
     }
-    stbi_write_png(_output_filename.c_str(), _scaled_width * _scalar, _scaled_height * _scalar, 
-                CHANNELS, _output, _scaled_width * _scalar * CHANNELS);
-    delete[] _output;
+
+    return writer.close();
 }
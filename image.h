@@ -10,15 +10,74 @@
 
 #include <iostream>
 #include <vector>
+#include <array>
 #include <cmath>
 #include <thread>
+#include <atomic>
 #include <cstdio>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include <ncurses.h>
+#include "color_quantizer.h"
+#include "edge_operator.h"
+#include "palette.h"
+#include "png_writer.h"
 
 using namespace std;
 using namespace cv;
 
+// Owns a decoded pixel buffer and frees it with whatever allocated it
+typedef unique_ptr<unsigned char, void (*)(void *)> pixel_buffer;
+
+// How cells are coloured in every output
+enum class ColorMode {
+    none,
+    truecolor,
+    xterm256
+};
+
+// How the grey plane is dithered against the luminance ramp
+enum class DitherMode {
+    none,
+    bayer,
+    floyd_steinberg,
+    atkinson
+};
+
+// Which plane the edge operator looks for edges in
+enum class EdgeSource {
+    greyscale,
+    blur,
+    dog
+};
+
+// Pipeline stages, each listed after every stage it reads. Results are kept
+// and only recomputed when something they depend on changes
+enum class Stage {
+    decode,
+    integral,
+    downscale,
+    blur,
+    dog,
+    gradients,
+    diffuse,
+    classify
+};
+constexpr int NUM_STAGES = 8;
+
+// The source pixels one output cell covers along an axis, from first on, 
+// and how much of each it covers
+struct Span {
+    int first;
+    vector<int> weights;
+};
+
+// How each cell's glyph is picked
+enum class GlyphMode {
+    luminance,
+    shape
+};
+
 class Image {
 public:
 // Public methods
@@ -26,54 +85,204 @@ public:
     Image(string filename);
     ~Image();
 
-    void to_ascii_index(const int& scalar);
-    void to_ascii_png();
+    void to_ascii_index(const int& scalar, const int& cell_aspect = 1);
+    void to_ascii_grid(const int& cols, const int& rows);
+    bool to_ascii_png();
+    bool to_ascii_text() const;
+    bool to_ascii_png_streamed(const int& scalar);
     void to_curses(WINDOW * win);
     void to_curses_multithread(WINDOW * win);
-    bool load();
+    void to_curses_scaled(WINDOW * win, const int& scalar);
+    void resize_curses();
+    bool probe();
+    size_t planned_bytes(const int& scalar, const bool& streamed = false) const;
+    bool should_stream(const int& scalar) const;
+    int fit_scalar(const int& scalar, const bool& streamed = false) const;
+    bool load(const int& scalar = 1);
     void load_live(const Mat & frame);
-    bool load_palette();
+    void set_palette(const Palette& palette);
     int get_width() const;
     int get_height() const;
+    const vector<vector<int>>& get_ascii_indeces() const;
     void set_filename(string new_filename);
     void set_output_filename(string new_output_filename);
     void set_dog_threshold(int new_dog_threshold);
+    void set_edge_threshold(int new_edge_threshold);
+    void set_integral_image(bool new_integral_image);
+    void set_memory_budget(size_t new_memory_budget);
+    void set_color_mode(ColorMode new_color_mode);
+    void set_dither_mode(DitherMode new_dither_mode);
+    void set_glyph_mode(GlyphMode new_glyph_mode);
+    void set_edge_source(EdgeSource new_edge_source);
+    void set_edge_operator(const EdgeOperator& new_edge_operator);
+    void set_edge_thinning(bool new_edge_thinning);
+    static void init_curses_colors();
+    int cache_hits(const Stage& stage) const;
+    int cache_misses(const Stage& stage) const;
 private:
 // Private methods
+    int decode_scale_for(const int& scalar) const;
+    void set_scalar(const int& scalar, const int& cell_aspect = 1);
+    void set_grid(const int& cols, const int& rows);
+    void fit_grid(const int& win_width, const int& win_height, const int& cell_aspect);
+    static void build_spans(const int& source, const int& cells, vector<Span>& spans);
+    unsigned stage_inputs(const Stage& stage) const;
+    unsigned needed_stages(const Stage& target) const;
+    size_t decode_key(const int& decode_scale) const;
+    size_t stage_key(const Stage& stage) const;
+    void run_stages(const Stage& target);
+    void classify();
     void scaled_greyscale_image();
-    int convolve(const int& x_pos, const int& y_pos) const;
-    int convolve(const vector<vector<int> >& matrix, const int& x_pos, 
-                 const int& y_pos, const vector<int>& kernel);
+    void resample();
+    template <int PLANES>
+    void resample_row(const unsigned char *row, vector<int>& across) const;
+    int convolve(const int& x_pos, const int& y_pos, Rgb& color, 
+                 int *quarter_sums = nullptr) const;
+    template <int BLOCK>
+    int convolve_block(const int& x_pos, const int& y_pos, Rgb& color, 
+                       int *quarter_sums) const;
+    void integral_image();
+    int area_sum(const int& plane, const int& x0, const int& y0, 
+                 const int& x1, const int& y1) const;
+    int convolve_integral(const int& x_pos, const int& y_pos, Rgb& color, 
+                          int *quarter_sums = nullptr) const;
+    int convolve(const vector<int> * const *rows, const int& x_pos, 
+                 const vector<int>& kernel) const;
     
-    double convolve(const int& x_pos, const int& y_pos, 
-                    const vector<vector<int> >& kernel);
+    void accumulate_row(const unsigned char *source_row, vector<int>& sums, 
+                        vector<int> *color_sums, int *quarter_sums = nullptr) const;
+    template <int BLOCK>
+    void accumulate_row_block(const unsigned char *source_row, vector<int>& sums, 
+                              vector<int> *color_sums, int *quarter_sums) const;
+    int shape_key(const int *quarter_sums) const;
+    void shape_row(const vector<int>& keys, vector<int>& indeces) const;
 
-    bool sobel(const int& x_pos, const int& y_pos, double& theta);
+    static int edge_direction(const int& gx, const int& gy);
+    void build_lumin_lut();
+    void lumin_row(const vector<int>& row, const int& y_pos, 
+                   vector<int>& indeces) const;
+    template <typename Wait>
+    void diffuse_row(vector<int>& row, vector<int> *below, vector<int> *below2, 
+                     vector<int>& levels, Wait wait_for) const;
+    void diffuse_errors();
+    void classify_row(const vector<int>& row, const int& y_pos, 
+                      const vector<int>& magnitudes, const vector<int>& directions, 
+                      vector<int>& indeces, 
+                      const vector<int> *levels = nullptr) const;
+    void edge_row(const vector<int>& above, const vector<int>& row, 
+                  const vector<int>& below, const vector<int>& grey, 
+                  vector<int>& magnitudes, vector<int>& directions);
+    void apply_edges(const vector<int>& magnitudes, const vector<int>& directions, 
+                     vector<int>& indeces) const;
+    void suppress_row(const vector<int>& above, const vector<int>& row, 
+                      const vector<int>& below, const vector<int>& directions, 
+                      vector<int>& magnitudes) const;
+    void gradients();
+    int edge_margin() const;
+    int streamed_halo() const;
+    void classify_row(const int& y_pos, vector<int>& indeces) const;
+    bool write_glyph_rows(PngWriter& writer, const vector<int>& indeces, 
+                          vector<unsigned char>& raster_row, 
+                          const vector<Rgb> *colors = nullptr) const;
+    template <int SCALAR>
+    void blit_glyph_row(unsigned char *pix, const vector<int>& indeces, 
+                        const int& glyph_y, const int *glyph_cols, 
+                        const vector<Rgb> *colors, 
+                        const unsigned char *background_run) const;
     void gaussian_blur(vector<vector<int> >& blurred_image, 
                        const vector<int>& kernel);
+    void blur_row(const vector<int> * const *rows, const vector<int>& kernel, 
+                  const int& y_pos, vector<int>& blurred) const;
+    void blur();
     void dog(); // woof
-    void to_curses_helper(vector<string>&, int start, int end);
-    char get_edge_character(double theta);
+    void dog_row(const vector<int>& blur_1, const vector<int>& blur_2, 
+                 const int& y_pos, vector<int>& dog) const;
+    void plan_curses(WINDOW * win);
+    void to_curses_helper(vector<vector<chtype>>&, int start, int end);
+    chtype curses_color(const Rgb& color) const;
     
 // Attributes
-    vector<unsigned char> _image;
-    unsigned char *_output;
-    vector<vector<vector<unsigned char>>> _palette;
-    string _ascii_palette = " .;iroebAM-\\|/";
+    pixel_buffer _image{nullptr, free};
+    Palette _palette;
     vector<vector<int>> _greyscale_image;
+    vector<vector<Rgb>> _color_image;
+    vector<vector<int>> _blur_1;
+    vector<vector<int>> _blur_2;
     vector<vector<int>> _dog;
+    vector<vector<int>> _magnitudes;
+    vector<vector<int>> _edges;
+    // scratch for edge_row(), gradients() and diffuse_errors(), kept so 
+    // frames of the same size allocate nothing
+    vector<int16_t> _gx;
+    vector<int16_t> _gy;
+    vector<int> _suppress_above;
+    vector<int> _suppress_row;
+    vector<vector<int>> _diffuse_work;
+    unique_ptr<atomic<int>[]> _diffuse_progress;
+    int _diffuse_rows = 0;
+    // summed area table of the decoded image, grey then r, g, b per pixel
+    vector<uint32_t> _integral;
+    int _integral_planes = 1;
     vector<vector<int>> _ascii_indeces;
+    vector<vector<int>> _lumin_levels;
+    vector<vector<int>> _shape_keys;
     int _width;
     int _height;
-    int _palette_width;
-    int _palette_height;
     int _scaled_width;
     int _scaled_height;
     int _scalar;
+    int _block_size;
+    // cells are _cell_aspect times taller than wide, in pixels and in blocks
+    int _cell_aspect = 1;
+    int _block_height;
+    // when set the grid is _scaled_width by _scaled_height whatever the 
+    // scalar, each cell an area weighted average of what it covers
+    bool _resample = false;
+    vector<Span> _column_spans;
+    vector<Span> _row_spans;
+    // resample() scratch, sized by set_grid()
+    vector<int> _across;
+    vector<int64_t> _halves;
+    // geometry of the fitted curses frames, kept until the window is resized
+    // or a frame of a different size comes in
+    bool _curses_planned = false;
+    int _planned_width = 0;
+    int _planned_height = 0;
+    int _x_offset = 0;
+    int _y_offset = 0;
+    vector<vector<chtype>> _screen_lines;
+    int _decode_scale = 1;
+    int _source_width = 0;
+    int _source_height = 0;
+    int _source_channels;
+    bool _is_jpeg = false;
+    bool _probed = false;
+    // size and modification time of the file when it was probed
+    size_t _file_stamp = 0;
+    size_t _memory_budget = 0;
+    ColorMode _color_mode = ColorMode::none;
+    DitherMode _dither_mode = DitherMode::none;
+    GlyphMode _glyph_mode = GlyphMode::luminance;
+    EdgeSource _edge_source = EdgeSource::greyscale;
+    const EdgeOperator *_edge_operator = &EdgeOperator::sobel();
+    bool _edge_thinning = false;
+    static const ColorQuantizer *_curses_colors;
+    array<size_t, NUM_STAGES> _stage_keys{};
+    unsigned _valid_stages = 0;
+    array<int, NUM_STAGES> _cache_hits{};
+    array<int, NUM_STAGES> _cache_misses{};
+    int _palette_version = 0;
+    int _frame_version = 0;
     int _dog_threshold;
+    int _edge_threshold = 400;
+    bool _integral_image = false;
     string _filename;
     string _output_filename;
-    const int _num_quantized_lumin = 10;
+    array<int, 256> _lumin_lut;
+    array<int, NUM_EDGE_GLYPHS> _edge_lut;
+    array<int, 16> _bayer_offsets;
+    vector<int> _level_grey;
+    int _rounding_offset;
 };
 
 #endif
@@ -12,47 +12,251 @@ const int CHANNELS = 3;
 #include <cstdio>
 #include <filesystem>
 #include <algorithm>
+#include <sstream>
+#include <chrono>
+#include <atomic>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
 #include "image.h"
+#include "frame_loader.h"
 
 using namespace std;
 using namespace cv;
 namespace fs = filesystem;
 
-void get_files(const string& path, vector<string>& dir) {
-    for (const auto & entry : fs::directory_iterator(path)) {
+/**
+ * @brief Memory budget per image from ASCII_MEMORY_BUDGET_MB, 0 for none
+ * 
+ * @return size_t - bytes
+ */
+size_t memory_budget() {
+    const char *budget_mb = getenv("ASCII_MEMORY_BUDGET_MB");
+    if (budget_mb == nullptr) {
+        return 0;
+    }
+    return static_cast<size_t>(atol(budget_mb)) * 1024 * 1024;
+}
+
+/**
+ * @brief Loads the palette described by the file in ASCII_PALETTE, or the 
+ *        built in one, along with its atlas
+ * 
+ * @param palette - palette to fill
+ * @param with_atlas - false when only the characters are needed
+ * @return true 
+ * @return false 
+ */
+bool load_palette(Palette& palette, const bool& with_atlas = true) {
+    const char *descriptor = getenv("ASCII_PALETTE");
+    if ((descriptor != nullptr) && !palette.load_descriptor(descriptor)) {
+        return false;
+    }
+    return !with_atlas || palette.load_atlas();
+}
+
+/**
+ * @brief Colour mode from ASCII_COLOR: 256 for xterm's 256 colours, off when
+ *        unset or 0 and 24 bit colour for anything else
+ * 
+ * @return ColorMode 
+ */
+ColorMode color_mode() {
+    const char *color = getenv("ASCII_COLOR");
+    if ((color == nullptr) || (string(color) == "0")) {
+        return ColorMode::none;
+    }
+    if (string(color) == "256") {
+        return ColorMode::xterm256;
+    }
+    return ColorMode::truecolor;
+}
+
+/**
+ * @brief Dithering from ASCII_DITHER: bayer, floyd or atkinson, off when 
+ *        unset or anything else
+ * 
+ * @return DitherMode 
+ */
+DitherMode dither_mode() {
+    const char *dither = getenv("ASCII_DITHER");
+    if (dither == nullptr) {
+        return DitherMode::none;
+    }
+    if (string(dither) == "bayer") {
+        return DitherMode::bayer;
+    }
+    if (string(dither) == "floyd") {
+        return DitherMode::floyd_steinberg;
+    }
+    if (string(dither) == "atkinson") {
+        return DitherMode::atkinson;
+    }
+    return DitherMode::none;
+}
+
+/**
+ * @brief Glyph selection from ASCII_GLYPHS: shape to match each cell's shape
+ *        against the atlas, luminance and edges otherwise
+ * 
+ * @return GlyphMode 
+ */
+GlyphMode glyph_mode() {
+    const char *glyphs = getenv("ASCII_GLYPHS");
+    if ((glyphs != nullptr) && (string(glyphs) == "shape")) {
+        return GlyphMode::shape;
+    }
+    return GlyphMode::luminance;
+}
+
+/**
+ * @brief Where edges are found from ASCII_EDGES: dog for the difference of 
+ *        gaussians, blur for the smaller of its two blurs, the greyscale 
+ *        otherwise
+ * 
+ * @return EdgeSource 
+ */
+EdgeSource edge_source() {
+    const char *edges = getenv("ASCII_EDGES");
+    if ((edges != nullptr) && (string(edges) == "dog")) {
+        return EdgeSource::dog;
+    }
+    if ((edges != nullptr) && (string(edges) == "blur")) {
+        return EdgeSource::blur;
+    }
+    return EdgeSource::greyscale;
+}
+
+/**
+ * @brief Edge kernel from ASCII_EDGE_OPERATOR: sobel, scharr or prewitt, 
+ *        sobel when unset or anything else
+ * 
+ * @return const EdgeOperator& 
+ */
+const EdgeOperator& edge_operator() {
+    const char *name = getenv("ASCII_EDGE_OPERATOR");
+    const EdgeOperator *op = (name == nullptr) ? nullptr : EdgeOperator::by_name(name);
+    return (op == nullptr) ? EdgeOperator::sobel() : *op;
+}
+
+/**
+ * @brief Edge thinning from ASCII_EDGE_THIN, on when set to anything but 0
+ * 
+ * @return bool 
+ */
+bool edge_thinning() {
+    const char *thin = getenv("ASCII_EDGE_THIN");
+    return (thin != nullptr) && (string(thin) != "0");
+}
+
+/**
+ * @brief Edge threshold from ASCII_EDGE_THRESHOLD, 400 when unset
+ * 
+ * @return int 
+ */
+int edge_threshold() {
+    const char *threshold = getenv("ASCII_EDGE_THRESHOLD");
+    if (threshold == nullptr) {
+        return 400;
+    }
+    return atoi(threshold);
+}
+
+/**
+ * @brief DoG threshold from ASCII_DOG_THRESHOLD, 8 when unset
+ * 
+ * @return int 
+ */
+int dog_threshold() {
+    const char *threshold = getenv("ASCII_DOG_THRESHOLD");
+    if (threshold == nullptr) {
+        return 8;
+    }
+    return atoi(threshold);
+}
+
+/**
+ * @brief Lists the names of the files in a directory in alphabetical order
+ * 
+ * @param path - directory to list
+ * @param dir - names are added to this
+ * @return true 
+ * @return false - if the directory can't be read
+ */
+bool get_files(const string& path, vector<string>& dir) {
+    error_code error;
+    fs::directory_iterator entries(path, error);
+    if (error) {
+        return false;
+    }
+    for (const auto & entry : entries) {
         dir.push_back(entry.path().filename().string());
     }
     sort(dir.begin(), dir.end());
+    return true;
 }
 
-void write_frame(const int& scalar, const int& first_frame, const int& num_frames, 
-                 const vector<string>& frame_filenames, 
-                 const vector<string>& output_frame_filenames) {
+/**
+ * @brief Sets up an image the way every frame of a directory mode is drawn
+ * 
+ * @param frame - image to set up
+ * @param palette - palette to draw with
+ */
+void setup_frame(Image& frame, const Palette& palette) {
+    frame.set_palette(palette);
+    frame.set_color_mode(color_mode());
+    frame.set_dither_mode(dither_mode());
+    frame.set_glyph_mode(glyph_mode());
+    frame.set_edge_source(edge_source());
+    frame.set_edge_operator(edge_operator());
+    frame.set_edge_threshold(edge_threshold());
+    frame.set_edge_thinning(edge_thinning());
+    frame.set_dog_threshold(dog_threshold());
+    frame.set_memory_budget(memory_budget());
+}
 
-    for (int i = first_frame; i < (first_frame + num_frames); i++) {
-        Image frame;
-        bool palette_success = frame.load_palette();
-        if (!palette_success) {
-            cout << "Error loading palette\n";
-            return;
+/**
+ * @brief Converts frames from the loader until there are none left. Several
+ *        of these run at once, each taking whichever frame is next
+ * 
+ * @param scalar - how much to down scale each frame
+ * @param cell_aspect - how many times taller than wide the palette's glyphs are
+ * @param loader - hands out the decoded frames
+ * @param num_frames - frames in the set, for the progress
+ * @param done - frames finished by every thread so far
+ */
+void write_frames(const int& scalar, const int& cell_aspect, FrameLoader& loader, 
+                  const int& num_frames, atomic<int>& done) {
+    FrameStatus status;
+    int i;
+    while ((i = loader.acquire(status)) >= 0) {
+        Image& frame = loader.image(i);
+        // probed by the loader already, unless that is what failed
+        bool streamed = false;
+        int frame_scalar = 0;
+        if (status != FrameStatus::failed) {
+            streamed = frame.should_stream(scalar);
+            frame_scalar = frame.fit_scalar(scalar, streamed);
         }
-        
-        frame.set_filename(frame_filenames[i]);
-        frame.set_output_filename(output_frame_filenames[i]);
 
-        bool success = frame.load();
-        if (!success) {
+        if (status == FrameStatus::failed) {
             cout << "Error loading image\n";
-            return;
+        } else if (frame_scalar == 0) {
+            cout << "Frame " << i << " exceeds the memory budget\n";
+        } else if (streamed) {
+            if (!frame.to_ascii_png_streamed(frame_scalar)) {
+                cout << "Error converting image\n";
+            }
+        } else {
+            frame.to_ascii_index(frame_scalar, cell_aspect);
+            if (!frame.to_ascii_png()) {
+                cout << "Error writing image\n";
+            }
         }
-        frame.to_ascii_index(scalar);
-        frame.to_ascii_png();
-        cout << "Frame " << (i + 1 - first_frame) << " of " << num_frames << ": " 
-             << ((i + 1 - first_frame) * 100) / num_frames << "%\n";
+        loader.release(i);
+
+        int finished = ++done;
+        cout << "Frame " << finished << " of " << num_frames << ": " 
+             << (finished * 100) / num_frames << "%\n";
     }
 }
 
@@ -60,19 +264,26 @@ void write_image() {
     string img_filename;
     string output_filename;
     int scalar;
-    int dog_threshold = 0;
     cout << "PATH to input image eg: `examples/helloworld.jpg`\n";
     cin >> img_filename;
     
-    Image img;
-    bool palette_success = img.load_palette();
-    if (!palette_success) {
+    Palette palette;
+    if (!load_palette(palette)) {
         cout << "Error Loading palette\n";
         return;
     }
+    Image img;
+    img.set_palette(palette);
+    img.set_color_mode(color_mode());
+    img.set_dither_mode(dither_mode());
+    img.set_glyph_mode(glyph_mode());
+    img.set_edge_source(edge_source());
+    img.set_edge_operator(edge_operator());
+    img.set_edge_threshold(edge_threshold());
+    img.set_edge_thinning(edge_thinning());
     img.set_filename(img_filename);
-    bool success = img.load();
-    if (!success) {
+    img.set_memory_budget(memory_budget());
+    if (!img.probe()) {
         cout << "Error loading image\n";
         return;
     }
@@ -81,13 +292,58 @@ void write_image() {
     " x " << img.get_height() << endl;
     cout << "Downscaling factor (multiple of 8): \n";
     cin >> scalar;
-    cout << "PATH output image ending in `.png` eg: `examples/helloworld_ascii.png`\n";
+
+    bool streamed = img.should_stream(scalar);
+    int fitted_scalar = img.fit_scalar(scalar, streamed);
+    if (fitted_scalar == 0) {
+        cout << "Image exceeds the memory budget\n";
+        return;
+    }
+    if (fitted_scalar != scalar) {
+        cout << "Downscaling factor raised to " << fitted_scalar 
+             << " to fit the memory budget\n";
+        scalar = fitted_scalar;
+    }
+
+    if (!streamed) {
+        bool success = img.load(scalar);
+        if (!success) {
+            cout << "Error loading image\n";
+            return;
+        }
+    }
+
+    cout << "PATH output image ending in `.png` eg: `examples/helloworld_ascii.png`\n"
+         << "(or `.txt` for text)\n";
     cin >> output_filename;
+    bool text_output = (output_filename.size() > 4) && 
+                       (output_filename.compare(output_filename.size() - 4, 4, ".txt") == 0);
+    if (!text_output && (palette.cell_aspect() == 0)) {
+        cout << "Palette cells must be a whole number of times taller than wide\n";
+        return;
+    }
     
-    img.set_dog_threshold(dog_threshold);
+    img.set_dog_threshold(dog_threshold());
     img.set_output_filename(output_filename);
-    img.to_ascii_index(scalar);
-    img.to_ascii_png();
+    if (streamed) {
+        if (text_output) {
+            cout << "Image exceeds the memory budget for text output\n";
+        } else if (!img.to_ascii_png_streamed(scalar)) {
+            cout << "Error converting image\n";
+        }
+        return;
+    }
+    if (text_output) {
+        img.to_ascii_index(scalar);
+        if (!img.to_ascii_text()) {
+            cout << "Error writing text\n";
+        }
+        return;
+    }
+    img.to_ascii_index(scalar, palette.cell_aspect());
+    if (!img.to_ascii_png()) {
+        cout << "Error writing image\n";
+    }
 }
 
 void write_video() {
@@ -98,59 +354,191 @@ void write_video() {
     dir_path = home + dir_path;
 
     vector<string> frame_filenames;
+    vector<string> input_frame_filenames;
     vector<string> output_frame_filenames;
-    get_files(dir_path, frame_filenames);
+    if (!get_files(dir_path, frame_filenames)) {
+        cout << "Error reading " << dir_path << "\n";
+        return;
+    }
 
     size_t num_frames = frame_filenames.size();
     for (size_t i = 0; i < num_frames; i++) {
+        input_frame_filenames.push_back((fs::path(dir_path) / frame_filenames[i]).string());
         output_frame_filenames.push_back("examples/output_frames/" + frame_filenames[i]);
     }
     
+    Palette palette;
+    if (!load_palette(palette)) {
+        cout << "Error loading palette\n";
+        return;
+    }
+    if (palette.cell_aspect() == 0) {
+        cout << "Palette cells must be a whole number of times taller than wide\n";
+        return;
+    }
+    
     int scalar = 8;
     int num_threads = 4;
-    int frames_per_thread = num_frames / num_threads;
+    int num_decoders = 2;
 
-    vector<thread*> thread_grp;
+    // output filenames go in by index as each frame is decoded
+    vector<Image> slots(num_threads + num_decoders);
+    for (Image& frame : slots) {
+        setup_frame(frame, palette);
+    }
+    auto decode = [&](Image& frame, const int& i) {
+        frame.set_output_filename(output_frame_filenames[i]);
+        if (!frame.probe()) {
+            return false;
+        }
+        bool streamed = frame.should_stream(scalar);
+        int frame_scalar = frame.fit_scalar(scalar, streamed);
+        // streamed frames are read by the writer, a row at a time
+        if (streamed || (frame_scalar == 0)) {
+            return true;
+        }
+        return frame.load(frame_scalar);
+    };
+    FrameLoader loader(input_frame_filenames, slots, decode, num_decoders, 8);
 
+    atomic<int> done{0};
+    vector<thread> thread_grp;
     for (int i = 0; i < num_threads; i++) {
-        thread_grp.push_back(new thread(write_frame, scalar, i * frames_per_thread, 
-                    frames_per_thread, frame_filenames, output_frame_filenames));
+        thread_grp.emplace_back(write_frames, scalar, palette.cell_aspect(), ref(loader), 
+                                num_frames, ref(done));
+    }
+    for (auto& t : thread_grp) {
+        t.join();
     }
+}
 
-    for (int i = 0; i < num_threads; i++) {
-        thread_grp[i]->join();
-        delete thread_grp[i];
+
+/**
+ * @brief Playback rate for -tv from ASCII_FPS, 24 when unset or not positive
+ * 
+ * @return double - frames per second
+ */
+double target_fps() {
+    const char *fps = getenv("ASCII_FPS");
+    if ((fps == nullptr) || (atof(fps) <= 0)) {
+        return 24;
     }
+    return atof(fps);
 }
 
-void write_curses(string img_filename, WINDOW * win) {
-    Image img;
-    img.set_filename(img_filename);
-    bool success = img.load();
-    if (!success) {
-        cout << "Error loading image\n";
+/**
+ * @brief Directory -tv plays from ASCII_FRAMES, examples/input_frames when 
+ *        unset
+ * 
+ * @return string 
+ */
+string frames_dir() {
+    const char *dir = getenv("ASCII_FRAMES");
+    if (dir == nullptr) {
+        return "examples/input_frames";
+    }
+    return dir;
+}
+
+/**
+ * @brief Plays the frames in frames_dir() at target_fps(). Frame i is due 
+ *        at start + i periods on the steady clock. A FrameLoader decodes 
+ *        frames ahead while the current one is drawn, and frames that are 
+ *        ready too late to show are dropped, without being decoded at all 
+ *        if the loader hasn't reached them yet. q stops early, achieved 
+ *        rate and drops are printed at the end
+ */
+void curses_video() {
+    const int NUM_SLOTS = 4;
+    const int NUM_DECODERS = 2;
+    const int READAHEAD = 8;
+    Palette palette;
+    if (!load_palette(palette, glyph_mode() == GlyphMode::shape)) {
+        cout << "Error loading palette\n";
         return;
     }
 
-    img.set_dog_threshold(0);
-    img.to_curses(win);
-}
+    string dir_path = frames_dir();
+    vector<string> dir;
+    if (!get_files(dir_path, dir)) {
+        cout << "Error reading " << dir_path << "\n";
+        return;
+    }
+    vector<string> filenames;
+    for (const string& name : dir) {
+        filenames.push_back((fs::path(dir_path) / name).string());
+    }
 
+    // each slot keeps its fitted geometry and planes from frame to frame
+    vector<Image> slots(NUM_SLOTS);
+    for (Image& img : slots) {
+        setup_frame(img, palette);
+    }
+    FrameLoader loader(filenames, slots, [](Image& img, const int&) { return img.load(); }, 
+                       NUM_DECODERS, READAHEAD);
 
-void curses_video() {
     initscr();
     cbreak();
     noecho();
-    vector<string> dir;
-    get_files("/Users/garrettrhoads/Documents/programmingProjects/CPP/Personal/Ascii-Art-Image-Converter/examples/input_frames", dir);
-    for (size_t frame = 0; frame < dir.size(); frame++) {
-        string filename = "examples/input_frames/" + dir[frame];
-        write_curses(filename.c_str(), stdscr);
+    // polled between frames for KEY_RESIZE and q
+    keypad(stdscr, TRUE);
+    nodelay(stdscr, TRUE);
+    Image::init_curses_colors();
+
+    auto period = chrono::duration_cast<chrono::steady_clock::duration>(
+        chrono::duration<double>(1.0 / target_fps()));
+    auto start = chrono::steady_clock::now();
+    int shown = 0;
+    int dropped = 0;
+    int failed = 0;
+    FrameStatus status;
+    int i;
+    while ((i = loader.acquire(status)) >= 0) {
+        int key = getch();
+        if (key == 'q') {
+            break;
+        }
+        if (key == KEY_RESIZE) {
+            for (Image& img : slots) {
+                img.resize_curses();
+            }
+        }
+
+        auto deadline = start + (i * period);
+        auto now = chrono::steady_clock::now();
+        loader.skip_before((now - start) / period);
+
+        if (status == FrameStatus::failed) {
+            failed++;
+        } else if ((status == FrameStatus::skipped) || (now >= (deadline + period))) {
+            // the next frame is due already
+            dropped++;
+        } else {
+            this_thread::sleep_until(deadline);
+            loader.image(i).to_curses(stdscr);
+            shown++;
+        }
+        loader.release(i);
     }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    loader.stop();
     endwin();
+
+    printf("Showed %d frames in %.1f s, %.1f fps against a target of %.1f, %d dropped", 
+           shown, elapsed.count(), (elapsed.count() > 0) ? (shown / elapsed.count()) : 0.0, 
+           target_fps(), dropped);
+    if (failed > 0) {
+        printf(", %d failed to load", failed);
+    }
+    printf("\n");
 }
 
 void mirror() {
+    Palette palette;
+    if (!load_palette(palette, glyph_mode() == GlyphMode::shape)) {
+        cout << "Error loading palette\n";
+        return;
+    }
     VideoCapture cap;
 
     for (int i = 0; i < 10; i++) {
@@ -168,6 +556,22 @@ void mirror() {
     initscr();
     cbreak();
     noecho();
+    // polled between frames for KEY_RESIZE
+    keypad(stdscr, TRUE);
+    nodelay(stdscr, TRUE);
+    Image::init_curses_colors();
+
+    // one image for every frame, so the fitted geometry carries over
+    Image img;
+    img.set_palette(palette);
+    img.set_color_mode(color_mode());
+    img.set_dither_mode(dither_mode());
+    img.set_glyph_mode(glyph_mode());
+    img.set_edge_source(edge_source());
+    img.set_edge_operator(edge_operator());
+    img.set_edge_threshold(edge_threshold());
+    img.set_edge_thinning(edge_thinning());
+    img.set_dog_threshold(dog_threshold());
 
     while (true) {
         bool ret = cap.read(frame);
@@ -176,10 +580,10 @@ void mirror() {
             cerr << "Failed to capture frame" << endl;
             break;
         }
-        Image img;
+        if (getch() == KEY_RESIZE) {
+            img.resize_curses();
+        }
         img.load_live(frame);
-    
-        img.set_dog_threshold(0);
         img.to_curses_multithread(stdscr);
     }
     endwin();
@@ -187,6 +591,144 @@ void mirror() {
     destroyAllWindows();
 }
 
+/**
+ * @brief Loads an image once and redraws it live while the scalar, 
+ *        thresholds, edge source and palette are tuned from the keyboard. 
+ *        Palettes cycle between the built in one and each descriptor in 
+ *        ASCII_PALETTE, which may list several separated by `:`
+ */
+void tui() {
+    string img_filename;
+    cout << "PATH to input image eg: `examples/helloworld.jpg`\n";
+    cin >> img_filename;
+
+    bool with_atlas = (glyph_mode() == GlyphMode::shape);
+    vector<Palette> palettes(1);
+    if (with_atlas && !palettes[0].load_atlas()) {
+        cout << "Error loading palette\n";
+        return;
+    }
+    const char *descriptors = getenv("ASCII_PALETTE");
+    if (descriptors != nullptr) {
+        stringstream list(descriptors);
+        string descriptor;
+        while (getline(list, descriptor, ':')) {
+            Palette palette;
+            if (!palette.load_descriptor(descriptor) || 
+                (with_atlas && !palette.load_atlas())) {
+                cout << "Error loading palette " << descriptor << endl;
+                return;
+            }
+            palettes.push_back(palette);
+        }
+    }
+
+    size_t palette = (palettes.size() > 1) ? 1 : 0;
+    int scalar = 4;
+    int dog = dog_threshold();
+    int edge = edge_threshold();
+    EdgeSource edges = edge_source();
+    const EdgeOperator *operators[] = {&EdgeOperator::sobel(), &EdgeOperator::scharr(), 
+                                       &EdgeOperator::prewitt()};
+    const int NUM_OPERATORS = 3;
+    int op = 0;
+    while ((op < (NUM_OPERATORS - 1)) && (operators[op] != &edge_operator())) {
+        op++;
+    }
+    const char *source_names[] = {"grey", "blur", "dog"};
+    bool thin = edge_thinning();
+
+    Image img;
+    img.set_palette(palettes[palette]);
+    img.set_color_mode(color_mode());
+    img.set_dither_mode(dither_mode());
+    img.set_glyph_mode(glyph_mode());
+    img.set_integral_image(true);
+    img.set_filename(img_filename);
+    if (!img.load()) {
+        cout << "Error loading image\n";
+        return;
+    }
+
+    initscr();
+    cbreak();
+    noecho();
+    keypad(stdscr, TRUE);
+    curs_set(0);
+    Image::init_curses_colors();
+    WINDOW *view = newwin(LINES - 1, COLS, 0, 0);
+
+    bool running = true;
+    while (running) {
+        img.set_dog_threshold(dog);
+        img.set_edge_threshold(edge);
+        img.set_edge_source(edges);
+        img.set_edge_operator(*operators[op]);
+        img.set_edge_thinning(thin);
+
+        auto start = chrono::steady_clock::now();
+        img.to_curses_scaled(view, scalar);
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+
+        int hits = 0;
+        int misses = 0;
+        for (int stage = 0; stage < NUM_STAGES; stage++) {
+            hits += img.cache_hits(static_cast<Stage>(stage));
+            misses += img.cache_misses(static_cast<Stage>(stage));
+        }
+        mvprintw(LINES - 1, 0, "scalar %d  dog %d  edge %d  edges %s %s%s  palette %zu/%zu  "
+                 "%.1f ms  cache %d/%d  +- [] ,. e o t p q", scalar, dog, edge, 
+                 operators[op]->name(), source_names[static_cast<int>(edges)], 
+                 thin ? " thin" : "", palette + 1, palettes.size(), elapsed.count(), 
+                 hits, hits + misses);
+        clrtoeol();
+        refresh();
+
+        switch (getch()) {
+        case '+':
+        case '=':
+            scalar++;
+            break;
+        case '-':
+            scalar = max(1, scalar - 1);
+            break;
+        case ']':
+            dog++;
+            break;
+        case '[':
+            dog = max(0, dog - 1);
+            break;
+        case '.':
+            edge += 25;
+            break;
+        case ',':
+            edge = max(0, edge - 25);
+            break;
+        case 'e':
+            edges = static_cast<EdgeSource>((static_cast<int>(edges) + 1) % 3);
+            break;
+        case 'o':
+            op = (op + 1) % NUM_OPERATORS;
+            break;
+        case 't':
+            thin = !thin;
+            break;
+        case 'p':
+            palette = (palette + 1) % palettes.size();
+            img.set_palette(palettes[palette]);
+            break;
+        case KEY_RESIZE:
+            wresize(view, LINES - 1, COLS);
+            break;
+        case 'q':
+            running = false;
+            break;
+        }
+    }
+    delwin(view);
+    endwin();
+}
+
 void parse_input(int argc, vector<string> argv) {
     if (argc != 2) { 
         cout << "expected one command line argument, use -h or --help for a list of options" << endl; 
@@ -219,7 +761,7 @@ void parse_input(int argc, vector<string> argv) {
     }
 
     if (argv[1] == "-tui") {
-        cout << "not implemented yet" << endl;
+        tui();
         return;
     }
 }
@@ -0,0 +1,352 @@
+/**
+ * @file palette.cc
+ * @author Garrett Rhoads
+ * @brief Palette methods
+ * @date 2025-01-20
+ */
+
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "palette.h"
+#include "palette_atlas.h"
+#include "stb_image.h"
+
+using namespace std;
+
+const int CHANNELS = 3;
+
+/**
+ * @brief Construct the built in palette
+ */
+Palette::Palette() {
+    _characters = string(DEFAULT_RAMP) + DEFAULT_EDGES;
+    _num_lumin = sizeof(DEFAULT_RAMP) - 1;
+    _cell_width = DEFAULT_CELL_WIDTH;
+    _cell_height = DEFAULT_CELL_HEIGHT;
+}
+
+/**
+ * @brief Reads a palette descriptor, one `key value` per line:
+ * 
+ *        atlas palette.png
+ *        cell 8 16
+ *        ramp  .:-=+*#%@
+ *        edges -\|/
+ * 
+ *        Everything after the space following `ramp` or `edges` is taken as 
+ *        is, so the ramp can start with a space. Lines starting with # are 
+ *        ignored and anything left out keeps its built in value, including 
+ *        the atlas, which only fits the built in ramp, edges and cell
+ * 
+ * @param filename - path of the descriptor
+ * @return true 
+ * @return false - if the file can't be read or doesn't make sense
+ */
+bool Palette::load_descriptor(const string& filename) {
+    ifstream file(filename);
+    if (!file) {
+        return false;
+    }
+
+    string ramp = DEFAULT_RAMP;
+    string edges = DEFAULT_EDGES;
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || (line[0] == '#')) {
+            continue;
+        }
+        size_t space = line.find(' ');
+        string key = line.substr(0, space);
+        string value = (space == string::npos) ? "" : line.substr(space + 1);
+
+        if (key == "atlas") {
+            _atlas_filename = value;
+        } else if (key == "cell") {
+            istringstream cell(value);
+            if (!(cell >> _cell_width >> _cell_height)) {
+                return false;
+            }
+        } else if (key == "ramp") {
+            ramp = value;
+        } else if (key == "edges") {
+            edges = value;
+        } else {
+            return false;
+        }
+    }
+
+    if ((ramp.size() < 2) || (ramp.size() > 256) || 
+        (edges.size() != NUM_EDGE_GLYPHS) || (_cell_width <= 0) || 
+        (_cell_width > MAX_CELL_WIDTH) || (_cell_height <= 0)) {
+        return false;
+    }
+    _characters = ramp + edges;
+    _num_lumin = ramp.size();
+    _masks.clear();
+    _shape_index.clear();
+    return true;
+}
+
+/**
+ * @brief Loads the atlas, from the file named in the descriptor if there was
+ *        one and from the copy built into the binary otherwise. The built in 
+ *        atlas only has the built in glyphs, so a descriptor that changes 
+ *        the ramp, edges or cell without naming an atlas fails here rather 
+ *        than drawing its characters with the wrong glyphs
+ * 
+ * @return true 
+ * @return false 
+ */
+bool Palette::load_atlas() {
+    if (_atlas_filename.empty()) {
+        if ((_characters != string(DEFAULT_RAMP) + DEFAULT_EDGES) || 
+            (_cell_width != DEFAULT_CELL_WIDTH) || (_cell_height != DEFAULT_CELL_HEIGHT)) {
+            return false;
+        }
+        return compile_atlas(EMBEDDED_ATLAS, EMBEDDED_ATLAS_WIDTH, EMBEDDED_ATLAS_HEIGHT);
+    }
+    return load_atlas(_atlas_filename);
+}
+
+/**
+ * @brief Loads the atlas from a png, overriding the built in one
+ * 
+ * @param filename - path of the atlas png
+ * @return true 
+ * @return false 
+ */
+bool Palette::load_atlas(const string& filename) {
+    int width, height, n;
+    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &n, CHANNELS);
+    if (data == nullptr) {
+        return false;
+    }
+    _atlas_filename = filename;
+    bool success = compile_atlas(data, width, height);
+    stbi_image_free(data);
+    return success;
+}
+
+/**
+ * @brief Turns a row major RGB atlas into per glyph bit masks. Pixels are 
+ *        split at the middle of the atlas' luminance range, whichever side 
+ *        has fewer pixels is the ink, and each side's average colour becomes
+ *        the foreground or background
+ * 
+ * @param data - RGB pixels of the atlas
+ * @param width - atlas width
+ * @param height - atlas height
+ * @return true 
+ * @return false - if the atlas is too small for the glyphs
+ */
+bool Palette::compile_atlas(const unsigned char *data, const int& width, 
+                            const int& height) {
+    int glyphs_width = num_glyphs() * _cell_width;
+    if ((width < glyphs_width) || (height < _cell_height)) {
+        return false;
+    }
+
+    int min_lumin = 255 * CHANNELS;
+    int max_lumin = 0;
+    for (int y = 0; y < _cell_height; y++) {
+        const unsigned char *pix = data + (static_cast<size_t>(y) * width * CHANNELS);
+        for (int x = 0; x < glyphs_width; x++, pix += CHANNELS) {
+            int lumin = pix[0] + pix[1] + pix[2];
+            min_lumin = min(min_lumin, lumin);
+            max_lumin = max(max_lumin, lumin);
+        }
+    }
+    int threshold = (min_lumin + max_lumin) / 2;
+
+    // sums[1] collects the bright side, sums[0] the dark side
+    size_t sums[2][CHANNELS] = {};
+    size_t counts[2] = {};
+    _masks.assign(num_glyphs() * _cell_height, 0);
+    for (int glyph = 0; glyph < num_glyphs(); glyph++) {
+        for (int y = 0; y < _cell_height; y++) {
+            const unsigned char *pix = data + 
+                ((static_cast<size_t>(y) * width + (glyph * _cell_width)) * CHANNELS);
+            uint64_t& mask = _masks[glyph * _cell_height + y];
+
+            for (int x = 0; x < _cell_width; x++, pix += CHANNELS) {
+                int bright = (pix[0] + pix[1] + pix[2]) > threshold;
+                mask |= static_cast<uint64_t>(bright) << x;
+                counts[bright]++;
+                for (int c = 0; c < CHANNELS; c++) {
+                    sums[bright][c] += pix[c];
+                }
+            }
+        }
+    }
+
+    int ink = (counts[1] <= counts[0]) ? 1 : 0;
+    if (ink == 0) {
+        for (uint64_t& mask : _masks) {
+            mask = ~mask & ((_cell_width == 64) ? ~0ULL : ((1ULL << _cell_width) - 1));
+        }
+    }
+    Rgb average[2] = {};
+    for (int side = 0; side < 2; side++) {
+        if (counts[side] != 0) {
+            average[side].r = sums[side][0] / counts[side];
+            average[side].g = sums[side][1] / counts[side];
+            average[side].b = sums[side][2] / counts[side];
+        }
+    }
+    _foreground = average[ink];
+    _background = average[1 - ink];
+    build_shape_index();
+    return true;
+}
+
+/**
+ * @brief Fills _shape_index with the glyph closest to every shape key. Each 
+ *        glyph is described by how much of each quarter of its cell is ink. 
+ *        A key's greys are turned into ink through the ramp, so a flat grey 
+ *        asks for as much ink as the ramp character for that grey has and 
+ *        flat areas come out the same as with luminance matching. Brute 
+ *        force, but only SHAPE_KEYS * num_glyphs() distances once per palette
+ */
+void Palette::build_shape_index() {
+    int mid_x = max(1, _cell_width / 2);
+    int mid_y = max(1, _cell_height / 2);
+    vector<array<int, 4>> ink(num_glyphs(), array<int, 4>{});
+    for (int glyph = 0; glyph < num_glyphs(); glyph++) {
+        for (int y = 0; y < _cell_height; y++) {
+            uint64_t mask = glyph_row(glyph, y);
+            for (int x = 0; x < _cell_width; x++) {
+                ink[glyph][((y >= mid_y) ? 2 : 0) + ((x >= mid_x) ? 1 : 0)] += (mask >> x) & 1;
+            }
+        }
+        for (int quarter = 0; quarter < 4; quarter++) {
+            int width = (quarter & 1) ? (_cell_width - mid_x) : mid_x;
+            int height = (quarter & 2) ? (_cell_height - mid_y) : mid_y;
+            ink[glyph][quarter] = (ink[glyph][quarter] * 255) / max(1, width * height);
+        }
+    }
+
+    // ink of each ramp character, never less than the one before it
+    vector<int> ramp_ink(_num_lumin);
+    for (int level = 0; level < _num_lumin; level++) {
+        const array<int, 4>& quarters = ink[level];
+        ramp_ink[level] = (quarters[0] + quarters[1] + quarters[2] + quarters[3]) / 4;
+        if (level > 0) {
+            ramp_ink[level] = max(ramp_ink[level], ramp_ink[level - 1]);
+        }
+    }
+    // the darkest and lightest levels stand for black and white
+    int level_ink[SHAPE_LEVELS];
+    for (int level = 0; level < SHAPE_LEVELS; level++) {
+        int grey = (level * 255) / (SHAPE_LEVELS - 1);
+        int scaled = grey * (_num_lumin - 1);
+        int step = min(scaled / 255, _num_lumin - 2);
+        int frac = scaled - (step * 255);
+        level_ink[level] = ramp_ink[step] + 
+                           (((ramp_ink[step + 1] - ramp_ink[step]) * frac) / 255);
+    }
+
+    _shape_index.resize(SHAPE_KEYS);
+    for (int key = 0; key < SHAPE_KEYS; key++) {
+        int target[4];
+        for (int quarter = 0; quarter < 4; quarter++) {
+            target[quarter] = level_ink[(key >> (SHAPE_BITS * (3 - quarter))) & (SHAPE_LEVELS - 1)];
+        }
+
+        int best_glyph = 0;
+        int best_distance = -1;
+        for (int glyph = 0; glyph < num_glyphs(); glyph++) {
+            int distance = 0;
+            for (int quarter = 0; quarter < 4; quarter++) {
+                int diff = ink[glyph][quarter] - target[quarter];
+                distance += diff * diff;
+            }
+            if ((best_distance < 0) || (distance < best_distance)) {
+                best_distance = distance;
+                best_glyph = glyph;
+            }
+        }
+        _shape_index[key] = best_glyph;
+    }
+}
+
+/**
+ * @brief Number of luminance levels, glyphs [0, num_lumin) are the ramp
+ * 
+ * @return int 
+ */
+int Palette::num_lumin() const {
+    return _num_lumin;
+}
+
+int Palette::num_glyphs() const {
+    return _characters.size();
+}
+
+/**
+ * @brief Glyph for a sobel direction
+ * 
+ * @param direction - 0 horizontal, 1 and 3 diagonal, 2 vertical
+ * @return int - glyph index
+ */
+int Palette::edge_glyph(const int& direction) const {
+    return _num_lumin + direction;
+}
+
+char Palette::character(const int& glyph) const {
+    return _characters[glyph];
+}
+
+int Palette::cell_width() const {
+    return _cell_width;
+}
+
+int Palette::cell_height() const {
+    return _cell_height;
+}
+
+/**
+ * @brief How many times taller than wide a glyph is, the shape png cells 
+ *        are drawn in
+ * 
+ * @return int - 0 when it isn't a whole number
+ */
+int Palette::cell_aspect() const {
+    return ((_cell_height % _cell_width) == 0) ? (_cell_height / _cell_width) : 0;
+}
+
+bool Palette::has_atlas() const {
+    return !_masks.empty();
+}
+
+/**
+ * @brief Gets one row of a glyph's mask
+ * 
+ * @param glyph - glyph index
+ * @param y - row within the glyph
+ * @return uint64_t - bit x is set where column x is ink
+ */
+uint64_t Palette::glyph_row(const int& glyph, const int& y) const {
+    return _masks[glyph * _cell_height + y];
+}
+
+const Rgb& Palette::foreground() const {
+    return _foreground;
+}
+
+const Rgb& Palette::background() const {
+    return _background;
+}
+
+/**
+ * @brief Glyph whose shape best matches a cell, needs the atlas
+ * 
+ * @param key - from shape_key()
+ * @return int - glyph index
+ */
+int Palette::shape_glyph(const int& key) const {
+    return _shape_index[key];
+}
@@ -0,0 +1,98 @@
+/**
+ * @file palette.h
+ * @author Garrett Rhoads
+ * @brief Palette class definition
+ * @date 2025-01-20
+ */
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Built in palette, used when no descriptor is given
+constexpr char DEFAULT_RAMP[] = " .;iroebAM";
+constexpr char DEFAULT_EDGES[] = "-\\|/";
+constexpr int DEFAULT_CELL_WIDTH = 8;
+constexpr int DEFAULT_CELL_HEIGHT = 8;
+constexpr int NUM_EDGE_GLYPHS = 4;
+constexpr int MAX_CELL_WIDTH = 64;
+// Shape keys quantise each quarter of a cell to SHAPE_LEVELS greys
+constexpr int SHAPE_BITS = 3;
+constexpr int SHAPE_LEVELS = 1 << SHAPE_BITS;
+constexpr int SHAPE_KEYS = SHAPE_LEVELS * SHAPE_LEVELS * SHAPE_LEVELS * SHAPE_LEVELS;
+
+struct Rgb {
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+};
+
+/**
+ * @brief The characters an image is drawn with: a luminance ramp from dark to
+ *        light, one edge character per sobel direction and an atlas with the
+ *        glyph of every character. The atlas png has the ramp then the edges
+ *        left to right, each cell_width by cell_height. Without an atlas file
+ *        the copy of palette.png built into the binary is used. Glyphs are 
+ *        kept as one bit per pixel masks plus a foreground and background 
+ *        colour, so the whole atlas stays in L1. Loading the atlas also 
+ *        indexes every glyph by the ink in each quarter of its cell, so a 
+ *        cell can be matched to the glyph shaped most like it
+ */
+class Palette {
+public:
+    Palette();
+
+    bool load_descriptor(const string& filename);
+    bool load_atlas();
+    bool load_atlas(const string& filename);
+
+    int num_lumin() const;
+    int num_glyphs() const;
+    int edge_glyph(const int& direction) const;
+    char character(const int& glyph) const;
+    int cell_width() const;
+    int cell_height() const;
+    int cell_aspect() const;
+    bool has_atlas() const;
+    uint64_t glyph_row(const int& glyph, const int& y) const;
+    const Rgb& foreground() const;
+    const Rgb& background() const;
+    int shape_glyph(const int& key) const;
+
+    /**
+     * @brief Packs the average grey of a cell's four quarters into a shape 
+     *        key for shape_glyph()
+     * 
+     * @param quarters - top left, top right, bottom left, bottom right
+     * @return int - key in [0, SHAPE_KEYS)
+     */
+    static int shape_key(const int quarters[4]) {
+        const int shift = 8 - SHAPE_BITS; // 256 greys down to SHAPE_LEVELS
+        return ((quarters[0] >> shift) << (3 * SHAPE_BITS)) | 
+               ((quarters[1] >> shift) << (2 * SHAPE_BITS)) | 
+               ((quarters[2] >> shift) << SHAPE_BITS) | (quarters[3] >> shift);
+    }
+private:
+    bool compile_atlas(const unsigned char *data, const int& width, const int& height);
+    void build_shape_index();
+
+    string _characters;
+    int _num_lumin;
+    int _cell_width;
+    int _cell_height;
+    // empty for the built in atlas
+    string _atlas_filename;
+    // one mask per glyph row, glyph major, bit x set where column x is ink
+    vector<uint64_t> _masks;
+    // best matching glyph for every shape key
+    vector<uint16_t> _shape_index;
+    Rgb _foreground;
+    Rgb _background;
+};
+
+#endif
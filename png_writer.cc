@@ -0,0 +1,140 @@
+/**
+ * @file png_writer.cc
+ * @author Garrett Rhoads
+ * @brief PngWriter methods
+ * @date 2025-01-20
+ */
+
+#include <cstdio>
+#include <string>
+#include "png_writer.h"
+
+using namespace std;
+
+/**
+ * @brief Construct a new PngWriter object
+ */
+PngWriter::PngWriter() {
+    _file = nullptr;
+    _png = nullptr;
+    _info = nullptr;
+}
+
+/**
+ * @brief Destroy the PngWriter object, anything not closed is abandoned
+ */
+PngWriter::~PngWriter() {
+    abandon();
+}
+
+/**
+ * @brief Creates the file and writes the png header
+ * 
+ * @param filename - path of the png to write
+ * @param width - width in pixels
+ * @param height - number of rows that will be written
+ * @return true 
+ * @return false 
+ */
+bool PngWriter::open(const string& filename, const int& width, const int& height) {
+    abandon();
+    _filename = filename;
+    _file = fopen(filename.c_str(), "wb");
+    if (_file == nullptr) {
+        return false;
+    }
+    _png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (_png != nullptr) {
+        _info = png_create_info_struct(_png);
+    }
+    if (_info == nullptr) {
+        abandon();
+        return false;
+    }
+    if (setjmp(png_jmpbuf(_png))) {
+        abandon();
+        return false;
+    }
+
+    png_init_io(_png, _file);
+    png_set_IHDR(_png, _info, width, height, 8, PNG_COLOR_TYPE_RGB, 
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, 
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(_png, _info);
+    return true;
+}
+
+/**
+ * @brief Compresses and writes the next row
+ * 
+ * @param row - width * 3 bytes of RGB
+ * @return true 
+ * @return false 
+ */
+bool PngWriter::write_row(const unsigned char *row) {
+    if (_png == nullptr) {
+        return false;
+    }
+    if (setjmp(png_jmpbuf(_png))) {
+        abandon();
+        return false;
+    }
+    png_write_row(_png, row);
+    return true;
+}
+
+/**
+ * @brief Finishes the png once every row has been written
+ * 
+ * @return true 
+ * @return false 
+ */
+bool PngWriter::close() {
+    if (_png == nullptr) {
+        return false;
+    }
+    if (setjmp(png_jmpbuf(_png))) {
+        abandon();
+        return false;
+    }
+    png_write_end(_png, nullptr);
+    // the last bytes are only flushed by fclose, a png that fails there is 
+    // truncated
+    if (!destroy()) {
+        remove(_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Closes an unfinished png and deletes it, so a failed write leaves 
+ *        no partial file behind
+ */
+void PngWriter::abandon() {
+    bool unfinished = (_file != nullptr);
+    destroy();
+    if (unfinished) {
+        remove(_filename.c_str());
+    }
+}
+
+/**
+ * @brief Frees libpng's structs and closes the file
+ * 
+ * @return true 
+ * @return false - the file couldn't be flushed and closed
+ */
+bool PngWriter::destroy() {
+    if (_png != nullptr) {
+        png_destroy_write_struct(&_png, (_info != nullptr) ? &_info : nullptr);
+    }
+    bool closed = true;
+    if (_file != nullptr) {
+        closed = (fclose(_file) == 0);
+    }
+    _file = nullptr;
+    _png = nullptr;
+    _info = nullptr;
+    return closed;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file png_writer.h
+ * @author Garrett Rhoads
+ * @brief PngWriter class definition
+ * @date 2025-01-20
+ */
+
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <cstdio>
+#include <string>
+#include <png.h>
+
+using namespace std;
+
+/**
+ * @brief Writes an RGB png one row at a time so the whole raster never has 
+ *        to be in memory
+ */
+class PngWriter {
+public:
+    PngWriter();
+    ~PngWriter();
+
+    bool open(const string& filename, const int& width, const int& height);
+    bool write_row(const unsigned char *row);
+    bool close();
+private:
+    void abandon();
+    bool destroy();
+
+    string _filename;
+    FILE *_file;
+    png_structp _png;
+    png_infop _info;
+};
+
+#endif
@@ -0,0 +1,652 @@
+/**
+ * @file golden_test.cc
+ * @author Garrett Rhoads
+ * @brief Golden output regression test: converts the examples and a few
+ *        synthetic patterns every which way and checks a hash of the glyph
+ *        grid and of the png against tests/goldens.txt
+ * @date 2025-01-20
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <filesystem>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "image.h"
+#include "png_writer.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+const int CHANNELS = 3;
+// cells of a failing grid printed by --diff
+const int MAX_DIFFS = 10;
+// glyphs in the long ramp, long enough that a truncated step width would
+// push white past its end
+const int LONG_RAMP = 190;
+const int ATLAS_CELL_WIDTH = 8;
+const int ATLAS_CELL_HEIGHT = 16;
+
+// How the cells are laid out: the shape of the palette's glyphs and drawn 
+// to a png, or only the grid of the terminal modes' cells twice as tall as 
+// wide, or of a fractional scale
+enum class Layout {
+    glyph,
+    tall,
+    fractional
+};
+
+// One way of converting an image, with the default palette unless it says
+struct Config {
+    string name;
+    bool streamed;
+    function<void(Image&)> setup;
+    const Palette *palette = nullptr;
+    Layout layout = Layout::glyph;
+};
+
+// Hashes of one conversion, indeces is 0 for streamed ones which keep no grid
+// and raster is 0 for grid only ones which draw no png
+struct Result {
+    uint64_t indeces;
+    uint64_t raster;
+};
+
+/**
+ * @brief Folds bytes into a 64 bit FNV-1a hash
+ *
+ * @param hash - hash so far
+ * @param bytes - bytes to add
+ * @param size - how many
+ * @return uint64_t
+ */
+static uint64_t fnv1a(uint64_t hash, const void *bytes, const size_t& size) {
+    const unsigned char *data = static_cast<const unsigned char *>(bytes);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+
+static uint64_t hash_indeces(const vector<vector<int>>& indeces) {
+    uint64_t hash = FNV_OFFSET;
+    for (const vector<int>& row : indeces) {
+        int32_t size = row.size();
+        hash = fnv1a(hash, &size, sizeof(size));
+        for (int index : row) {
+            int32_t value = index;
+            hash = fnv1a(hash, &value, sizeof(value));
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Hashes the pixels of a png rather than its bytes, so a different
+ *        zlib doesn't count as a change
+ *
+ * @param filename - png to hash
+ * @param hash - hash of its size and pixels
+ * @return true
+ * @return false - it couldn't be read
+ */
+static bool hash_raster(const string& filename, uint64_t& hash) {
+    int width, height, n;
+    unsigned char *pix = stbi_load(filename.c_str(), &width, &height, &n, CHANNELS);
+    if (pix == nullptr) {
+        return false;
+    }
+    hash = fnv1a(FNV_OFFSET, &width, sizeof(width));
+    hash = fnv1a(hash, &height, sizeof(height));
+    hash = fnv1a(hash, pix, static_cast<size_t>(width) * height * CHANNELS);
+    stbi_image_free(pix);
+    return true;
+}
+
+/**
+ * @brief Writes a synthetic test pattern as a png
+ *
+ * @param filename - where to write it
+ * @param width - pixels across
+ * @param height - pixels down
+ * @param pattern - fills in the rgb of pixel x, y
+ * @return true
+ * @return false
+ */
+static bool write_pattern(const string& filename, const int& width, const int& height,
+                          const function<void(int, int, unsigned char *)>& pattern) {
+    PngWriter writer;
+    if (!writer.open(filename, width, height)) {
+        return false;
+    }
+    vector<unsigned char> row(static_cast<size_t>(width) * CHANNELS);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            pattern(x, y, &row[x * CHANNELS]);
+        }
+        if (!writer.write_row(row.data())) {
+            return false;
+        }
+    }
+    return writer.close();
+}
+
+/**
+ * @brief Writes the synthetic patterns: smooth gradients for the dithering,
+ *        a checkerboard for block alignment, rings and stripes for edges
+ *        in every direction. Odd sizes so the right and bottom remainders
+ *        are exercised too
+ *
+ * @param dir - where to write them
+ * @param inputs - their filenames are added to this
+ * @return true
+ * @return false
+ */
+static bool write_patterns(const string& dir, vector<string>& inputs) {
+    auto gradient = [](int x, int y, unsigned char *pix) {
+        pix[0] = (x * 255) / 330;
+        pix[1] = (y * 255) / 210;
+        pix[2] = (x + y) & 0xFF;
+    };
+    auto checker = [](int x, int y, unsigned char *pix) {
+        unsigned char v = (((x / 6) + (y / 6)) & 1) ? 230 : 20;
+        pix[0] = v;
+        pix[1] = v;
+        pix[2] = v;
+    };
+    auto rings = [](int x, int y, unsigned char *pix) {
+        int r = static_cast<int>(sqrt(static_cast<double>(((x - 150) * (x - 150)) +
+                                                          ((y - 150) * (y - 150)))));
+        unsigned char v = ((r / 7) & 1) ? 240 : 15;
+        pix[0] = v;
+        pix[1] = (v + r) & 0xFF;
+        pix[2] = 255 - v;
+    };
+    auto stripes = [](int x, int y, unsigned char *pix) {
+        unsigned char v = ((((x * 3) + (y * 5)) / 23) & 1) ? 200 : 40;
+        if (((y / 40) & 1) && ((x % 29) < 4)) {
+            v = 0;
+        }
+        pix[0] = v;
+        pix[1] = v;
+        pix[2] = v;
+    };
+    struct Pattern {
+        string name;
+        int width;
+        int height;
+        function<void(int, int, unsigned char *)> fill;
+    };
+    vector<Pattern> patterns = {{"gradient", 331, 211, gradient},
+                                {"checker", 256, 191, checker},
+                                {"rings", 301, 301, rings},
+                                {"stripes", 320, 243, stripes}};
+    for (const Pattern& pattern : patterns) {
+        string filename = dir + "/" + pattern.name + ".png";
+        if (!write_pattern(filename, pattern.width, pattern.height, pattern.fill)) {
+            return false;
+        }
+        inputs.push_back(filename);
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a descriptor and atlas for a ramp of LONG_RAMP glyphs, each
+ *        inked a little more than the one before, and loads them
+ *
+ * @param dir - where to write them
+ * @param palette - palette to load them into
+ * @return true
+ * @return false
+ */
+static bool load_long_ramp(const string& dir, Palette& palette) {
+    string atlas = dir + "/long_ramp.png";
+    int cell_pixels = ATLAS_CELL_WIDTH * ATLAS_CELL_HEIGHT;
+    auto glyphs = [cell_pixels](int x, int y, unsigned char *pix) {
+        int glyph = x / ATLAS_CELL_WIDTH;
+        int pixel = (y * ATLAS_CELL_WIDTH) + (x % ATLAS_CELL_WIDTH);
+        bool ink;
+        if (glyph < LONG_RAMP) {
+            ink = pixel < ((glyph * cell_pixels) / (LONG_RAMP - 1));
+        } else {
+            // the four edge glyphs: - \ | /
+            int column = x % ATLAS_CELL_WIDTH;
+            int edge = glyph - LONG_RAMP;
+            ink = ((edge == 0) && (y == ATLAS_CELL_HEIGHT / 2)) ||
+                  ((edge == 1) && (column == y / 2)) ||
+                  ((edge == 2) && (column == ATLAS_CELL_WIDTH / 2)) ||
+                  ((edge == 3) && (column == (ATLAS_CELL_WIDTH - 1) - (y / 2)));
+        }
+        unsigned char v = ink ? 255 : 0;
+        pix[0] = v;
+        pix[1] = v;
+        pix[2] = v;
+    };
+    if (!write_pattern(atlas, (LONG_RAMP + 4) * ATLAS_CELL_WIDTH, ATLAS_CELL_HEIGHT, glyphs)) {
+        return false;
+    }
+
+    string descriptor = dir + "/long_ramp.txt";
+    string ramp;
+    for (int glyph = 0; glyph < LONG_RAMP; glyph++) {
+        ramp += static_cast<char>(' ' + (glyph % 95));
+    }
+    ofstream out(descriptor);
+    out << "atlas " << atlas << "\n"
+        << "cell " << ATLAS_CELL_WIDTH << " " << ATLAS_CELL_HEIGHT << "\n"
+        << "ramp " << ramp << "\n";
+    out.close();
+    return out && palette.load_descriptor(descriptor) && palette.load_atlas();
+}
+
+/**
+ * @brief Checks that a descriptor which changes the glyphs without naming an
+ *        atlas is refused instead of drawn with the built in atlas' glyphs,
+ *        and that one which keeps them still gets the built in atlas
+ *
+ * @param dir - where to write the descriptors
+ * @return true
+ * @return false
+ */
+static bool check_atlas_required(const string& dir) {
+    string changed = dir + "/no_atlas_ramp.txt";
+    ofstream(changed) << "ramp  .oO@\n";
+    string kept = dir + "/no_atlas_edges.txt";
+    ofstream(kept) << "edges -\\|/\n";
+
+    Palette changed_palette;
+    Palette kept_palette;
+    return changed_palette.load_descriptor(changed) && !changed_palette.load_atlas() &&
+           kept_palette.load_descriptor(kept) && kept_palette.load_atlas();
+}
+
+/**
+ * @brief The conversions every input goes through
+ *
+ * @param long_ramp - palette for the long_ramp configs
+ * @param small - image smaller than every input, loaded whole before the
+ *        streamed_reused conversion so it runs on an Image that already
+ *        holds a decode
+ * @return vector<Config>
+ */
+static vector<Config> configs(const Palette& long_ramp, const string& small) {
+    return {
+        {"plain", false, [](Image&) {}},
+        {"edges100", false, [](Image& img) { img.set_edge_threshold(100); }},
+        {"edges1000", false, [](Image& img) { img.set_edge_threshold(1000); }},
+        {"color", false, [](Image& img) { img.set_color_mode(ColorMode::truecolor); }},
+        {"integral", false, [](Image& img) {
+            img.set_integral_image(true);
+            img.set_color_mode(ColorMode::truecolor);
+        }},
+        {"bayer", false, [](Image& img) { img.set_dither_mode(DitherMode::bayer); }},
+        {"floyd", false, [](Image& img) { img.set_dither_mode(DitherMode::floyd_steinberg); }},
+        {"atkinson", false, [](Image& img) { img.set_dither_mode(DitherMode::atkinson); }},
+        {"shape", false, [](Image& img) { img.set_glyph_mode(GlyphMode::shape); }},
+        {"dog", false, [](Image& img) {
+            img.set_edge_source(EdgeSource::dog);
+            img.set_dog_threshold(4);
+        }},
+        {"blur", false, [](Image& img) {
+            img.set_edge_source(EdgeSource::blur);
+            img.set_edge_threshold(100);
+        }},
+        {"scharr", false, [](Image& img) {
+            img.set_edge_operator(EdgeOperator::scharr());
+            img.set_edge_threshold(100);
+        }},
+        {"prewitt", false, [](Image& img) {
+            img.set_edge_operator(EdgeOperator::prewitt());
+            img.set_edge_threshold(100);
+        }},
+        {"thin", false, [](Image& img) {
+            img.set_edge_thinning(true);
+            img.set_edge_threshold(100);
+        }},
+        {"streamed", true, [](Image&) {}},
+        {"streamed_color", true, [](Image& img) { img.set_color_mode(ColorMode::truecolor); }},
+        {"streamed_floyd", true, [](Image& img) {
+            img.set_dither_mode(DitherMode::floyd_steinberg);
+        }},
+        {"streamed_shape", true, [](Image& img) { img.set_glyph_mode(GlyphMode::shape); }},
+        {"streamed_thin", true, [](Image& img) {
+            img.set_edge_thinning(true);
+            img.set_edge_threshold(100);
+        }},
+        {"streamed_dog", true, [](Image& img) {
+            img.set_edge_source(EdgeSource::dog);
+            img.set_dog_threshold(4);
+        }},
+        {"streamed_blur", true, [](Image& img) {
+            img.set_edge_source(EdgeSource::blur);
+            img.set_edge_threshold(100);
+        }},
+        {"streamed_reused", true, [small](Image& img) {
+            img.set_filename(small);
+            img.load();
+        }},
+        {"long_ramp", false, [](Image&) {}, &long_ramp},
+        {"long_ramp_bayer", false, [](Image& img) {
+            img.set_dither_mode(DitherMode::bayer);
+        }, &long_ramp},
+        {"long_ramp_floyd", false, [](Image& img) {
+            img.set_dither_mode(DitherMode::floyd_steinberg);
+        }, &long_ramp},
+        {"long_ramp_atkinson", false, [](Image& img) {
+            img.set_dither_mode(DitherMode::atkinson);
+        }, &long_ramp},
+        {"streamed_long_ramp", true, [](Image&) {}, &long_ramp},
+        {"tall", false, [](Image&) {}, nullptr, Layout::tall},
+        {"tall_shape", false, [](Image& img) {
+            img.set_glyph_mode(GlyphMode::shape);
+        }, nullptr, Layout::tall},
+        {"fractional", false, [](Image&) {}, nullptr, Layout::fractional},
+        {"fractional_shape", false, [](Image& img) {
+            img.set_glyph_mode(GlyphMode::shape);
+        }, nullptr, Layout::fractional},
+        {"fractional_floyd", false, [](Image& img) {
+            img.set_dither_mode(DitherMode::floyd_steinberg);
+        }, nullptr, Layout::fractional}
+    };
+}
+
+/**
+ * @brief Converts one input one way
+ *
+ * @param input - image to convert
+ * @param config - how
+ * @param scalar - downscale
+ * @param palette - palette with its atlas loaded, the config's own if it has one
+ * @param output - png to write
+ * @param result - hashes of the grid and the png
+ * @param grid - the grid, left empty for streamed conversions
+ * @return true
+ * @return false - the conversion failed
+ */
+static bool convert(const string& input, const Config& config, const int& scalar,
+                    const Palette& palette, const string& output, Result& result,
+                    vector<vector<int>>& grid) {
+    Image img;
+    img.set_palette(palette);
+    img.set_dog_threshold(8);
+    config.setup(img);
+    img.set_filename(input);
+    img.set_output_filename(output);
+
+    grid.clear();
+    result.indeces = 0;
+    result.raster = 0;
+    if (config.layout != Layout::glyph) {
+        if (config.layout == Layout::tall) {
+            if (!img.load(scalar)) {
+                return false;
+            }
+            img.to_ascii_index(scalar, 2);
+        } else {
+            // 1.4 times scalar, so no cell lines up with whole pixels
+            if (!img.load()) {
+                return false;
+            }
+            int cols = (img.get_width() * 5) / (scalar * 7);
+            int rows = (img.get_height() * 5) / (scalar * 7 * 2);
+            img.to_ascii_grid(cols, rows);
+        }
+        grid = img.get_ascii_indeces();
+        result.indeces = hash_indeces(grid);
+        return true;
+    }
+    if (config.streamed) {
+        if (!img.to_ascii_png_streamed(scalar)) {
+            return false;
+        }
+    } else {
+        if (!img.load(scalar)) {
+            return false;
+        }
+        img.to_ascii_index(scalar, palette.cell_aspect());
+        if (!img.to_ascii_png()) {
+            return false;
+        }
+        grid = img.get_ascii_indeces();
+        result.indeces = hash_indeces(grid);
+    }
+    return hash_raster(output, result.raster);
+}
+
+static string grid_filename(const string& dir, const string& name) {
+    return dir + "/" + name + ".txt";
+}
+
+/**
+ * @brief Writes a grid as the palette's characters, one line per row
+ */
+static bool dump_grid(const string& filename, const vector<vector<int>>& grid,
+                      const Palette& palette) {
+    ofstream out(filename);
+    for (const vector<int>& row : grid) {
+        for (int index : row) {
+            out << palette.character(index);
+        }
+        out << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+/**
+ * @brief Prints where a grid differs from one dumped earlier with --dump
+ */
+static void diff_grid(const string& filename, const vector<vector<int>>& grid,
+                      const Palette& palette) {
+    ifstream in(filename);
+    if (!in) {
+        cout << "    no dump at " << filename << "\n";
+        return;
+    }
+    vector<string> expected;
+    string line;
+    while (getline(in, line)) {
+        expected.push_back(line);
+    }
+    if (expected.size() != grid.size()) {
+        cout << "    " << expected.size() << " rows before, " << grid.size() << " now\n";
+    }
+    int differences = 0;
+    for (size_t i = 0; i < min(expected.size(), grid.size()); i++) {
+        if (expected[i].size() != grid[i].size()) {
+            cout << "    row " << i << ": " << expected[i].size() << " cells before, "
+                 << grid[i].size() << " now\n";
+            differences++;
+            continue;
+        }
+        for (size_t j = 0; j < grid[i].size(); j++) {
+            char now = palette.character(grid[i][j]);
+            if (expected[i][j] != now) {
+                if (differences < MAX_DIFFS) {
+                    cout << "    row " << i << " col " << j << ": '" << expected[i][j]
+                         << "' before, '" << now << "' now\n";
+                }
+                differences++;
+            }
+        }
+    }
+    cout << "    " << differences << " cells differ\n";
+}
+
+static bool read_goldens(const string& filename, map<string, Result>& goldens) {
+    ifstream in(filename);
+    if (!in) {
+        return false;
+    }
+    string name;
+    Result result;
+    while (in >> name >> hex >> result.indeces >> result.raster >> dec) {
+        goldens[name] = result;
+    }
+    return true;
+}
+
+static void usage() {
+    cout << "usage: golden_test SOURCE_DIR [--jpeg | --patterns] [--update | --dump DIR | --diff DIR]\n"
+            "  checks every conversion against SOURCE_DIR/tests/goldens.txt\n"
+            "  --jpeg      only checks the jpeg examples, which depend on the libjpeg build\n"
+            "  --patterns  only checks the generated patterns\n"
+            "  --update    rewrites the goldens from this build, for every input\n"
+            "  --dump      also writes every grid to DIR, run it on a known good tree\n"
+            "  --diff      prints where failing grids differ from the ones in DIR\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    string source_dir = argv[1];
+    string inputs_set;
+    string mode;
+    string grid_dir;
+    for (int arg = 2; arg < argc; arg++) {
+        string option = argv[arg];
+        if (((option == "--jpeg") || (option == "--patterns")) && inputs_set.empty()) {
+            inputs_set = option;
+        } else if ((option == "--update") && mode.empty()) {
+            mode = option;
+        } else if (((option == "--dump") || (option == "--diff")) && mode.empty() &&
+                   (arg + 1 < argc)) {
+            mode = option;
+            grid_dir = argv[++arg];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    // the goldens file is rewritten whole, so every input has to be redone
+    if ((mode == "--update") && !inputs_set.empty()) {
+        usage();
+        return 2;
+    }
+    bool check_jpeg = (inputs_set != "--patterns");
+    bool check_patterns = (inputs_set != "--jpeg");
+    string goldens_file = source_dir + "/tests/goldens.txt";
+    string output_dir = "golden_out";
+    fs::create_directories(output_dir);
+    if (mode == "--dump") {
+        fs::create_directories(grid_dir);
+    }
+
+    Palette palette;
+    if (!palette.load_atlas()) {
+        cout << "Error loading palette\n";
+        return 2;
+    }
+    Palette long_ramp;
+    if (!load_long_ramp(output_dir, long_ramp)) {
+        cout << "Error loading the long ramp palette\n";
+        return 2;
+    }
+    vector<string> inputs;
+    if (check_jpeg) {
+        inputs.push_back(source_dir + "/examples/helloworld.jpg");
+        inputs.push_back(source_dir + "/examples/homer.jpg");
+    }
+    vector<string> patterns;
+    string small = output_dir + "/small.png";
+    if (!write_patterns(output_dir, patterns) ||
+        !write_pattern(small, 37, 23, [](int x, int y, unsigned char *pix) {
+            pix[0] = x * 6;
+            pix[1] = y * 11;
+            pix[2] = 128;
+        })) {
+        cout << "Error writing patterns\n";
+        return 2;
+    }
+    if (check_patterns) {
+        inputs.insert(inputs.end(), patterns.begin(), patterns.end());
+    }
+
+    map<string, Result> goldens;
+    if ((mode != "--update") && !read_goldens(goldens_file, goldens)) {
+        cout << "Error reading " << goldens_file << ", make them with --update\n";
+        return 2;
+    }
+
+    const int scalars[] = {2, 3, 8};
+    stringstream updated;
+    int checked = 0;
+    int failed = 0;
+    bool atlas_required = !check_patterns || check_atlas_required(output_dir);
+    if (!atlas_required) {
+        cout << "FAIL a descriptor that changes the glyphs loaded without an atlas\n";
+    }
+    for (const string& input : inputs) {
+        for (const Config& config : configs(long_ramp, small)) {
+            const Palette& used = (config.palette != nullptr) ? *config.palette : palette;
+            for (int scalar : scalars) {
+                string name = fs::path(input).stem().string() + "_" + config.name + "_" +
+                              to_string(scalar);
+                Result result;
+                vector<vector<int>> grid;
+                checked++;
+                if (!convert(input, config, scalar, used,
+                             output_dir + "/" + name + ".png", result, grid)) {
+                    cout << "FAIL " << name << ": conversion failed\n";
+                    failed++;
+                    continue;
+                }
+                updated << name << " " << hex << result.indeces << " "
+                        << result.raster << dec << "\n";
+                if (mode == "--dump") {
+                    dump_grid(grid_filename(grid_dir, name), grid, used);
+                }
+                if (mode == "--update") {
+                    continue;
+                }
+
+                auto golden = goldens.find(name);
+                if (golden == goldens.end()) {
+                    cout << "FAIL " << name << ": no golden\n";
+                    failed++;
+                    continue;
+                }
+                bool same_grid = (golden->second.indeces == result.indeces);
+                bool same_raster = (golden->second.raster == result.raster);
+                if (!same_grid || !same_raster) {
+                    cout << "FAIL " << name << ":" << (same_grid ? "" : " grid")
+                         << (same_raster ? "" : " raster") << " changed\n";
+                    failed++;
+                    if ((mode == "--diff") && !grid.empty()) {
+                        diff_grid(grid_filename(grid_dir, name), grid, used);
+                    }
+                }
+            }
+        }
+    }
+
+    if (mode == "--update") {
+        // a conversion that failed would silently lose its golden
+        if (failed > 0) {
+            cout << failed << " of " << checked << " conversions failed, "
+                 << goldens_file << " not written\n";
+            return 1;
+        }
+        ofstream out(goldens_file);
+        out << updated.str();
+        cout << "Wrote " << goldens_file << "\n";
+        return out ? (atlas_required ? 0 : 1) : 2;
+    }
+    cout << (checked - failed) << " of " << checked << " conversions match their goldens\n";
+    if (failed > 0) {
+        cout << "Run golden_test on a known good tree with --dump DIR, then this one "
+                "with --diff DIR to see which cells changed\n";
+    }
+    return ((failed > 0) || !atlas_required) ? 1 : 0;
+}